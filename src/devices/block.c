@@ -139,6 +139,183 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    check_sector (block, sector + cnt - 1);
+  check_sector (block, sector);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   If the driver supports it, this is a single request to the
+   device rather than one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  check_sectors (block, sector, cnt);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  If the driver supports it, this is a single request to
+   the device rather than one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  size_t i;
+
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         buffer + i * BLOCK_SECTOR_SIZE);
+  block->write_cnt += cnt;
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK,
+   sector SECTOR + I into BUFFERS[I], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  If the driver supports it, this is a
+   single request to the device rather than one per sector, even
+   though the buffers are scattered.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector, size_t cnt,
+             void *const buffers[])
+{
+  size_t i;
+
+  check_sectors (block, sector, cnt);
+  if (block->ops->readv != NULL)
+    block->ops->readv (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i, buffers[i]);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK,
+   sector SECTOR + I from BUFFERS[I], which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the block device has
+   acknowledged receiving the data.  If the driver supports it,
+   this is a single request to the device rather than one per
+   sector, even though the buffers are scattered.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, block_sector_t sector, size_t cnt,
+              const void *const buffers[])
+{
+  size_t i;
+
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->writev != NULL)
+    block->ops->writev (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i, buffers[i]);
+  block->write_cnt += cnt;
+}
+
+/* Initializes REQ to read CNT sectors into BUFFER, or to write
+   them from BUFFER if WRITE is true.  BUFFER must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes; to give each sector its own
+   buffer instead, point REQ->BUFFERS at an array of CNT sector
+   buffers afterward.
+   When the request completes, DONE is called with REQ and AUX
+   if DONE is nonnull.  DONE runs in thread context with
+   interrupts on, but in the driver's thread, which runs the
+   device's other requests and may hold the device's lock, or in
+   the submitter's thread for a driver that completes requests
+   before block_submit() returns.  So DONE must not wait for
+   another block request, nor acquire a lock that the submitter
+   may hold while it waits for REQ.  If DONE is null, the submitter
+   waits for completion with block_wait() instead. */
+void
+block_request_init (struct block_request *req, bool write, size_t cnt,
+                    void *buffer, block_done_func *done, void *aux)
+{
+  req->write = write;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->buffers = NULL;
+  req->done = done;
+  req->aux = aux;
+  sema_init (&req->sema, 0);
+}
+
+/* Starts REQ on the sectors of BLOCK starting at SECTOR, queuing
+   it behind requests already under way.  If the driver supports
+   it, returns without waiting for the transfer, so that the
+   caller may overlap it with other work and the device can go
+   from one request to the next without waiting for threads.
+   Otherwise, the request has completed on return. */
+void
+block_submit (struct block *block, block_sector_t sector,
+              struct block_request *req)
+{
+  check_sectors (block, sector, req->cnt);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+
+  if (req->write)
+    block->write_cnt += req->cnt;
+  else
+    block->read_cnt += req->cnt;
+  req->sector = sector;
+  req->pos = 0;
+
+  if (req->cnt == 0)
+    block_complete (req);
+  else if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, req);
+  else
+    {
+      for (; req->pos < req->cnt; req->pos++)
+        if (req->write)
+          block->ops->write (block->aux, sector + req->pos,
+                             block_request_buffer (req, req->pos));
+        else
+          block->ops->read (block->aux, sector + req->pos,
+                            block_request_buffer (req, req->pos));
+      block_complete (req);
+    }
+}
+
+/* Waits for REQ, which must have been initialized without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->done == NULL);
+  sema_down (&req->sema);
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -211,6 +388,28 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Returns the buffer for sector IDX of REQ. */
+void *
+block_request_buffer (const struct block_request *req, size_t idx)
+{
+  ASSERT (idx < req->cnt);
+  if (req->buffers != NULL)
+    return req->buffers[idx];
+  return req->buffer + idx * BLOCK_SECTOR_SIZE;
+}
+
+/* Called by a driver when REQ has completed, from thread context,
+   possibly with the device's lock held.  Notifies the submitter,
+   as block_request_init() describes. */
+void
+block_complete (struct block_request *req)
+{
+  if (req->done != NULL)
+    req->done (req, req->aux);
+  else
+    sema_up (&req->sema);
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -220,4 +419,3 @@ list_elem_to_block (struct list_elem *list_elem)
           ? list_entry (list_elem, struct block, list_elem)
           : NULL);
 }
-
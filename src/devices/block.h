@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,50 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_readv (struct block *, block_sector_t, size_t cnt,
+                  void *const buffers[]);
+void block_writev (struct block *, block_sector_t, size_t cnt,
+                   const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+struct block_request;
+typedef void block_done_func (struct block_request *, void *aux);
+
+/* A request to read or write consecutive sectors, which runs
+   while its submitter goes on with other work.  Set up with
+   block_request_init(), then started with block_submit().  The
+   request and its buffers must stay in place until it completes. */
+struct block_request
+  {
+    /* Set by the submitter. */
+    bool write;                 /* Write, or read? */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;            /* CNT sectors, if BUFFERS is null. */
+    void *const *buffers;       /* One buffer per sector, or null. */
+    block_done_func *done;      /* Completion callback, or null. */
+    void *aux;                  /* Passed to DONE. */
+
+    /* Owned by the block layer and driver until completion. */
+    block_sector_t sector;      /* First device sector. */
+    size_t pos;                 /* Sectors transferred so far. */
+    void *driver;               /* For the driver's use. */
+    struct list_elem elem;      /* For the driver's use. */
+    struct semaphore sema;      /* Up'd on completion if DONE is null. */
+  };
+
+void block_request_init (struct block_request *, bool write, size_t cnt,
+                         void *buffer, block_done_func *, void *aux);
+void block_submit (struct block *, block_sector_t,
+                   struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +108,33 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in one request.
+       Optional: if null, the block layer falls back to one
+       read or write call per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Transfer CNT consecutive sectors in one request, each to or
+       from its own buffer in BUFFERS[].  Optional, likewise. */
+    void (*readv) (void *aux, block_sector_t, size_t cnt,
+                   void *const buffers[]);
+    void (*writev) (void *aux, block_sector_t, size_t cnt,
+                    const void *const buffers[]);
+
+    /* Start REQ, whose SECTOR the block layer has set, and return
+       without waiting for it; call block_complete() when it is
+       done.  Optional: if null, the block layer does the transfer
+       itself before block_submit() returns. */
+    void (*submit) (void *aux, struct block_request *req);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void *block_request_buffer (const struct block_request *, size_t idx);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
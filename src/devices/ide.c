@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -72,6 +73,13 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* Requests for the disks on this channel, which the channel's
+       worker thread runs in order. */
+    struct lock queue_lock;     /* Protects QUEUE. */
+    struct condition queue_cond;        /* Signaled when QUEUE gains a
+                                           request. */
+    struct list queue;          /* Requests waiting their turn. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,7 +93,11 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void queue_request (struct ata_disk *, struct block_request *);
+static thread_func channel_worker NO_RETURN;
+static void run_request (struct channel *, struct block_request *);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -126,6 +138,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->queue_lock);
+      cond_init (&c->queue_cond);
+      list_init (&c->queue);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -138,8 +153,10 @@ ide_init (void)
           d->is_ata = false;
         }
 
-      /* Register interrupt handler. */
+      /* Register interrupt handler, and start the worker thread
+         that runs requests, which partition scanning needs. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+      thread_create (c->name, PRI_MAX, channel_worker, c);
 
       /* Reset hardware. */
       reset_channel (c);
@@ -271,15 +288,18 @@ identify_ata_device (struct ata_disk *d)
   /* Send the IDENTIFY DEVICE command, wait for an interrupt
      indicating the device's response is ready, and read the data
      into our buffer. */
+  lock_acquire (&c->lock);
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
+      lock_release (&c->lock);
       return;
     }
   input_sector (c, id);
+  lock_release (&c->lock);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -337,6 +357,83 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Maximum number of sectors in a single READ SECTOR or WRITE
+   SECTOR command.  A sector count register value of 0 means 256. */
+#define MAX_SECTORS_PER_CMD 256
+
+/* Transfers REQ on the sectors of disk D starting at SEC_NO, and
+   waits for it to complete. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no,
+          struct block_request *req)
+{
+  req->sector = sec_no;
+  queue_request (d, req);
+  block_wait (req);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                   void *buffer)
+{
+  struct block_request req;
+
+  block_request_init (&req, false, cnt, buffer, NULL, NULL);
+  transfer (d, sec_no, &req);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  struct block_request req;
+
+  block_request_init (&req, true, cnt, (void *) buffer, NULL, NULL);
+  transfer (d, sec_no, &req);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D,
+   each into its own buffer in BUFFERS[], with the same commands
+   as ide_read_multiple().
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_readv (void *d, block_sector_t sec_no, size_t cnt,
+           void *const buffers[])
+{
+  struct block_request req;
+
+  block_request_init (&req, false, cnt, NULL, NULL, NULL);
+  req.buffers = buffers;
+  transfer (d, sec_no, &req);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D,
+   each from its own buffer in BUFFERS[], with the same commands
+   as ide_write_multiple().
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_writev (void *d, block_sector_t sec_no, size_t cnt,
+            const void *const buffers[])
+{
+  struct block_request req;
+
+  block_request_init (&req, true, cnt, NULL, NULL, NULL);
+  req.buffers = (void *const *) buffers;
+  transfer (d, sec_no, &req);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +441,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +452,142 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Starts REQ on disk D and returns without waiting for it.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_submit (void *d, struct block_request *req)
+{
+  queue_request (d, req);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_readv,
+    ide_writev,
+    ide_submit
   };
-
+
+/* Request queue.
+
+   Each channel runs one request at a time, in the order they
+   were queued, in a worker thread of its own, issuing one READ
+   SECTOR or WRITE SECTOR command per MAX_SECTORS_PER_CMD sectors.
+   The worker issues each command and moves each sector in or out
+   with interrupts on and the channel lock held.  The interrupt
+   handler only wakes it up, so that interrupts are never off for
+   longer than it takes to do that. */
+
+/* Adds REQ, on disk D starting at REQ->SECTOR, to the end of its
+   channel's queue. */
+static void
+queue_request (struct ata_disk *d, struct block_request *req)
+{
+  struct channel *c = d->channel;
+
+  ASSERT (req->sector + req->cnt <= (1UL << 28));
+
+  if (req->cnt == 0)
+    {
+      block_complete (req);
+      return;
+    }
+
+  req->driver = d;
+  req->pos = 0;
+  lock_acquire (&c->queue_lock);
+  list_push_back (&c->queue, &req->elem);
+  cond_signal (&c->queue_cond, &c->queue_lock);
+  lock_release (&c->queue_lock);
+}
+
+/* Worker thread for channel C_.  Runs the requests queued on it
+   one after another, forever. */
+static void
+channel_worker (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct block_request *req;
+
+      lock_acquire (&c->queue_lock);
+      while (list_empty (&c->queue))
+        cond_wait (&c->queue_cond, &c->queue_lock);
+      req = list_entry (list_pop_front (&c->queue),
+                        struct block_request, elem);
+      lock_release (&c->queue_lock);
+
+      lock_acquire (&c->lock);
+      run_request (c, req);
+      lock_release (&c->lock);
+      block_complete (req);
+    }
+}
+
+/* Transfers the sectors of REQ on channel C, whose lock must be
+   held. */
+static void
+run_request (struct channel *c, struct block_request *req)
+{
+  struct ata_disk *d = req->driver;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  while (req->pos < req->cnt)
+    {
+      size_t left = req->cnt - req->pos;
+      size_t chunk = left < MAX_SECTORS_PER_CMD ? left : MAX_SECTORS_PER_CMD;
+      size_t i;
+
+      select_sector (d, req->sector + req->pos, chunk);
+      issue_pio_command (c, (req->write ? CMD_WRITE_SECTOR_RETRY
+                             : CMD_READ_SECTOR_RETRY));
+      for (i = 0; i < chunk; i++, req->pos++)
+        if (req->write)
+          {
+            /* The disk asks for each sector with DRQ and interrupts
+               once it has taken it. */
+            if (!wait_while_busy (d))
+              PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                     d->name, req->sector + req->pos);
+            output_sector (c, block_request_buffer (req, req->pos));
+            sema_down (&c->completion_wait);
+          }
+        else
+          {
+            /* The disk interrupts once per sector that is ready. */
+            sema_down (&c->completion_wait);
+            if (!wait_while_busy (d))
+              PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                     d->name, req->sector + req->pos);
+            input_sector (c, block_request_buffer (req, req->pos));
+          }
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between 1
+   and MAX_SECTORS_PER_CMD, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
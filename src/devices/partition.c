@@ -317,8 +317,62 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, as a single request to the underlying device. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, size_t cnt,
+                         void *buffer)
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFER, as a single request to the underlying device. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector, size_t cnt,
+                          const void *buffer)
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, cnt, buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFERS[], as a single request to the underlying device. */
+static void
+partition_readv (void *p_, block_sector_t sector, size_t cnt,
+                 void *const buffers[])
+{
+  struct partition *p = p_;
+  block_readv (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFERS[], as a single request to the underlying device. */
+static void
+partition_writev (void *p_, block_sector_t sector, size_t cnt,
+                  const void *const buffers[])
+{
+  struct partition *p = p_;
+  block_writev (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Starts REQ on partition P by passing it on to the underlying
+   device. */
+static void
+partition_submit (void *p_, struct block_request *req)
+{
+  struct partition *p = p_;
+  block_submit (p->block, p->start + req->sector, req);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple,
+    partition_readv,
+    partition_writev,
+    partition_submit
   };
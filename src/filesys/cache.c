@@ -0,0 +1,425 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* The flush thread wakes up this often, in timer ticks, to write
+   back sectors dirty for longer than cache_flush_age. */
+#define FLUSH_INTERVAL (TIMER_FREQ)
+
+/* A writer that makes more than DIRTY_LIMIT sectors dirty writes
+   them all back itself before it continues. */
+#define DIRTY_LIMIT (CACHE_SIZE * 3 / 4)
+
+/* Most sectors written back in one request. */
+#define FLUSH_BATCH 16
+
+int cache_flush_age = 5000;
+
+/* Sector number of an unused cache entry. */
+#define INVALID_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector cached, or INVALID_SECTOR. */
+    bool dirty;                         /* Newer than the disk copy? */
+    int64_t dirty_since;                /* Tick when DIRTY became true. */
+    bool accessed;                      /* Used since the clock hand passed? */
+    bool pinned;                        /* Kept from disk until unpinned? */
+    struct lock lock;                   /* Held while in use. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the SECTOR and PINNED fields of the entries, the clock
+   hand, and the dirty count.  May be held while trying, but not
+   waiting, for an entry's lock, so that lookups never wait for I/O
+   with it held. */
+static struct lock cache_lock;
+static size_t hand;                     /* Clock hand for eviction. */
+static size_t dirty_cnt;                /* Number of dirty entries. */
+
+/* Serializes write-back, which uses the rest. */
+static struct lock flush_lock;
+static struct block_request flush_reqs[CACHE_SIZE]; /* One per run. */
+static size_t flush_first[CACHE_SIZE];  /* Each run's first entry. */
+static void *flush_bufs[CACHE_SIZE];    /* Each entry's data. */
+
+/* Sectors queued for the read-ahead thread.  A full queue drops
+   new requests, since read-ahead is only a hint. */
+#define READAHEAD_QUEUE 32
+static block_sector_t readahead_queue[READAHEAD_QUEUE];
+static size_t readahead_head;           /* Index of oldest request. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct lock readahead_lock;
+static struct condition readahead_cond; /* Signaled when queue is nonempty. */
+
+static struct cache_entry *cache_get (block_sector_t, bool read);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_victim (void);
+static void cache_write_entry (block_sector_t, const void *, int ofs,
+                               int size, bool pin);
+static void cache_writeback (int64_t min_age);
+static thread_func flush_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its write-back and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].sector = INVALID_SECTOR;
+      cache[i].dirty = false;
+      cache[i].accessed = false;
+      cache[i].pinned = false;
+      lock_init (&cache[i].lock);
+    }
+  hand = 0;
+  dirty_cnt = 0;
+  lock_init (&flush_lock);
+  lock_init (&readahead_lock);
+  cond_init (&readahead_cond);
+  readahead_head = readahead_cnt = 0;
+
+  thread_create ("flush", PRI_MIN, flush_daemon, NULL);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes at offset OFS within SECTOR of the file system
+   device into BUFFER, through the cache. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  struct cache_entry *e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR of the
+   file system device, through the cache.  The sector reaches the
+   disk when it is evicted or flushed, unless too much of the
+   cache is dirty, in which case the caller writes it back now. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  cache_write_entry (sector, buffer, ofs, size, false);
+}
+
+/* Like cache_write(), but also pins SECTOR in the cache: it stays
+   cached, and is not written to disk, until cache_unpin().  This
+   lets the journal write a sector to the log before it reaches its
+   home on disk. */
+void
+cache_write_pinned (block_sector_t sector, const void *buffer, int ofs,
+                    int size)
+{
+  cache_write_entry (sector, buffer, ofs, size, true);
+}
+
+/* Unpins SECTOR, which must be pinned, so that it may be written
+   back and evicted again. */
+void
+cache_unpin (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  ASSERT (e != NULL && e->pinned);
+  e->pinned = false;
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR, and
+   pins the sector if PIN is true. */
+static void
+cache_write_entry (block_sector_t sector, const void *buffer, int ofs,
+                   int size, bool pin)
+{
+  bool throttle = false;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A write of the whole sector need not read it first. */
+  struct cache_entry *e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  if (!e->dirty || (pin && !e->pinned))
+    {
+      lock_acquire (&cache_lock);
+      if (!e->dirty)
+        {
+          e->dirty = true;
+          e->dirty_since = timer_ticks ();
+          throttle = ++dirty_cnt > DIRTY_LIMIT;
+        }
+      if (pin)
+        e->pinned = true;
+      lock_release (&cache_lock);
+    }
+  lock_release (&e->lock);
+
+  if (throttle)
+    cache_writeback (0);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache, so
+   that a later read of it does not wait for the disk. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE)
+    {
+      readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_QUEUE]
+        = sector;
+      cond_signal (&readahead_cond, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty sector in the cache back to disk. */
+void
+cache_flush (void)
+{
+  cache_writeback (0);
+}
+
+/* Writes back the sectors that have been dirty for at least
+   MIN_AGE ticks, except pinned ones.  Runs of consecutive sectors
+   go to the disk in one request of up to FLUSH_BATCH sectors,
+   straight from the cache entries that hold them, and all the
+   requests are queued at once, so the disk goes from one to the
+   next without waiting for this thread. */
+static void
+cache_writeback (int64_t min_age)
+{
+  struct cache_entry *batch[CACHE_SIZE];
+  block_sector_t sectors[CACHE_SIZE];
+  int64_t now = timer_ticks ();
+  size_t cnt = 0;
+  size_t req_cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&flush_lock);
+
+  /* Collect the entries to write, sorted by sector. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (!e->dirty || e->pinned || now - e->dirty_since < min_age)
+        continue;
+      for (j = cnt++; j > 0 && sectors[j - 1] > e->sector; j--)
+        {
+          batch[j] = batch[j - 1];
+          sectors[j] = sectors[j - 1];
+        }
+      batch[j] = e;
+      sectors[j] = e->sector;
+    }
+  lock_release (&cache_lock);
+
+  /* Start a write for each run.  The run's entries stay locked
+     until the write completes, so that none of them is evicted
+     and read back from disk before then.  Entries are locked in
+     sector order and nobody else holds two at once, so this cannot
+     deadlock. */
+  for (i = 0; i < cnt; )
+    {
+      struct block_request *req = &flush_reqs[req_cnt];
+      size_t n = 0;
+      while (i + n < cnt && n < FLUSH_BATCH
+             && sectors[i + n] == sectors[i] + n)
+        {
+          struct cache_entry *e = batch[i + n];
+          lock_acquire (&e->lock);
+          if (e->sector != sectors[i + n] || !e->dirty || e->pinned)
+            {
+              /* Written back, reused, or pinned since we looked. */
+              lock_release (&e->lock);
+              break;
+            }
+          flush_bufs[i + n] = e->data;
+          n++;
+        }
+      if (n == 0)
+        {
+          i++;
+          continue;
+        }
+
+      block_request_init (req, true, n, NULL, NULL, NULL);
+      req->buffers = flush_bufs + i;
+      flush_first[req_cnt++] = i;
+      block_submit (fs_device, sectors[i], req);
+      i += n;
+    }
+
+  /* As each write completes, its entries are clean. */
+  for (i = 0; i < req_cnt; i++)
+    {
+      size_t first = flush_first[i];
+      size_t n = flush_reqs[i].cnt;
+
+      block_wait (&flush_reqs[i]);
+      lock_acquire (&cache_lock);
+      for (j = first; j < first + n; j++)
+        batch[j]->dirty = false;
+      dirty_cnt -= n;
+      lock_release (&cache_lock);
+      for (j = first; j < first + n; j++)
+        lock_release (&batch[j]->lock);
+    }
+
+  lock_release (&flush_lock);
+}
+
+/* Returns the cache entry for SECTOR, with its lock held, loading
+   the sector into the cache if necessary.  If READ is false, the
+   caller overwrites the whole sector, so a newly cached sector is
+   not read from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  ASSERT (sector != INVALID_SECTOR);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      struct cache_entry *e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  The entry may be reused for another sector while
+             we wait for it, so check again. */
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->sector == sector)
+            {
+              e->accessed = true;
+              return e;
+            }
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          continue;
+        }
+
+      /* Miss.  Write back the victim under its old sector number,
+         so that anyone who wants that sector meanwhile waits for
+         the write to finish. */
+      e = cache_victim ();
+      if (e->dirty)
+        {
+          lock_release (&cache_lock);
+          block_write (fs_device, e->sector, e->data);
+          lock_acquire (&cache_lock);
+          e->dirty = false;
+          dirty_cnt--;
+          if (cache_lookup (sector) != NULL)
+            {
+              /* Someone else cached SECTOR while we wrote. */
+              lock_release (&e->lock);
+              continue;
+            }
+        }
+      e->sector = sector;
+      lock_release (&cache_lock);
+
+      if (read)
+        block_read (fs_device, sector, e->data);
+      e->accessed = true;
+      return e;
+    }
+}
+
+/* Returns the entry caching SECTOR, or a null pointer if there is
+   none.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to reuse by the clock algorithm, passing over
+   pinned entries, and returns it with its lock held.  CACHE_LOCK
+   must be held. */
+static struct cache_entry *
+cache_victim (void)
+{
+  size_t step;
+
+  for (step = 0; ; step++)
+    {
+      struct cache_entry *e = &cache[hand];
+      hand = (hand + 1) % CACHE_SIZE;
+
+      if (!e->pinned)
+        {
+          if (e->sector != INVALID_SECTOR && e->accessed)
+            e->accessed = false;
+          else if (lock_try_acquire (&e->lock))
+            return e;
+        }
+
+      if (step >= 2 * CACHE_SIZE)
+        {
+          /* Every entry is in use.  Let their users finish. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          step = 0;
+        }
+    }
+}
+
+/* Every FLUSH_INTERVAL ticks, writes back the sectors that have
+   been dirty for cache_flush_age milliseconds, which bounds how
+   much is lost in a crash. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_writeback ((int64_t) cache_flush_age * TIMER_FREQ / 1000);
+    }
+}
+
+/* Reads queued read-ahead sectors into the cache. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_cond, &readahead_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      lock_release (&cache_get (sector, true)->lock);
+    }
+}
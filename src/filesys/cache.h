@@ -0,0 +1,18 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Sectors dirty for at least this many milliseconds are written
+   back by the flush thread. */
+extern int cache_flush_age;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *, int ofs, int size);
+void cache_write (block_sector_t, const void *, int ofs, int size);
+void cache_write_pinned (block_sector_t, const void *, int ofs, int size);
+void cache_unpin (block_sector_t);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,164 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of names cached. */
+#define DCACHE_SIZE 128
+
+/* A cached name. */
+struct dcache_entry
+  {
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* File's inode sector, or
+                                           DCACHE_NEGATIVE. */
+    bool in_use;                        /* In NAMES? */
+    struct hash_elem hash_elem;         /* Element in NAMES. */
+    struct list_elem lru_elem;          /* Element in LRU. */
+  };
+
+static struct dcache_entry entries[DCACHE_SIZE];
+
+/* Entries in use, by directory and name, and all entries, least
+   recently used first.  Protected by DCACHE_LOCK. */
+static struct hash names;
+static struct list lru;
+static struct lock dcache_lock;
+
+static struct dcache_entry *dcache_find (block_sector_t dir,
+                                         const char *name);
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&names, dcache_hash, dcache_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      entries[i].in_use = false;
+      list_push_back (&lru, &entries[i].lru_elem);
+    }
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the cache knows of it, stores its inode sector into *SECTORP,
+   or DCACHE_NEGATIVE if it does not exist, and returns true.
+   Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e != NULL)
+    {
+      list_remove (&e->lru_elem);
+      list_push_back (&lru, &e->lru_elem);
+      *sectorp = e->sector;
+    }
+  lock_release (&dcache_lock);
+  return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+   has its inode in SECTOR, or does not exist if SECTOR is
+   DCACHE_NEGATIVE.  Replaces any earlier entry for NAME, and if
+   the cache is full, the least recently used entry. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dcache_entry *e;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = dcache_find (dir, name);
+  if (e == NULL)
+    {
+      e = list_entry (list_front (&lru), struct dcache_entry, lru_elem);
+      if (e->in_use)
+        hash_delete (&names, &e->hash_elem);
+      e->dir = dir;
+      strlcpy (e->name, name, sizeof e->name);
+      e->in_use = true;
+      hash_insert (&names, &e->hash_elem);
+    }
+  e->sector = sector;
+  list_remove (&e->lru_elem);
+  list_push_back (&lru, &e->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector
+   DIR, which is being deleted. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      struct dcache_entry *e = &entries[i];
+      if (e->in_use && e->dir == dir)
+        {
+          hash_delete (&names, &e->hash_elem);
+          e->in_use = false;
+          list_remove (&e->lru_elem);
+          list_push_front (&lru, &e->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there is
+   none.  DCACHE_LOCK must be held. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&names, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Name cache hash function. */
+static unsigned
+dcache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct dcache_entry *e = hash_entry (e_, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (e->name) ^ hash_int (e->dir);
+}
+
+/* Name cache comparison function. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,7 +1,10 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -19,14 +22,94 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool overflow;                      /* See below. */
+    char unused[11];                    /* Pad to 32 bytes. */
   };
 
+/* A directory is a hash table of DIR_BUCKETS buckets, each a
+   sector of BUCKET_ENTRIES entries.  A name goes in the bucket its
+   hash selects, or if that is full, in the next bucket with room.
+   The first entry of a full bucket has OVERFLOW set, which tells
+   lookups to go on to the next bucket.  Unused buckets are holes
+   in the directory file, which read as free entries, so that a
+   directory takes disk space only for the buckets it uses, and
+   dir_readdir() can still read the entries in order, skipping the
+   holes.  An OVERFLOW flag is cleared again once no entry past the
+   bucket has a home bucket that needs it. */
+#define DIR_BUCKETS 4096
+#define BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define BUCKET_SIZE (BUCKET_ENTRIES * sizeof (struct dir_entry))
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR.  Returns true if successful, false on failure.
+   Every directory has room for DIR_BUCKETS * BUCKET_ENTRIES
+   entries, of which ENTRY_CNT must be no more. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  ASSERT (BUCKET_SIZE == BLOCK_SECTOR_SIZE);
+  ASSERT (entry_cnt <= DIR_BUCKETS * BUCKET_ENTRIES);
+  return inode_create (sector, DIR_BUCKETS * BUCKET_SIZE);
+}
+
+/* Returns the byte offset of the bucket for NAME. */
+static off_t
+home_bucket (const char *name)
+{
+  return hash_string (name) % DIR_BUCKETS * BUCKET_SIZE;
+}
+
+/* Returns the byte offset of the bucket after the one at OFS. */
+static off_t
+next_bucket (off_t ofs)
+{
+  return (ofs + BUCKET_SIZE) % (DIR_BUCKETS * BUCKET_SIZE);
+}
+
+/* Reads the bucket at byte offset OFS in DIR into ENTRIES, which
+   must have room for BUCKET_ENTRIES entries.  Returns true if
+   successful. */
+static bool
+read_bucket (const struct dir *dir, off_t ofs, struct dir_entry *entries)
+{
+  return inode_read_at (dir->inode, entries, BUCKET_SIZE, ofs)
+         == BUCKET_SIZE;
+}
+
+/* Returns the number of buckets a lookup probes past the bucket at
+   FROM to reach the one at TO. */
+static size_t
+bucket_distance (off_t from, off_t to)
+{
+  return ((to - from) / BUCKET_SIZE + DIR_BUCKETS) % DIR_BUCKETS;
+}
+
+/* Returns true if the bucket at BUCKET in DIR must keep its
+   OVERFLOW flag: that is, if the buckets after it that lookups
+   reach through it hold an entry whose home bucket is at or
+   before BUCKET.  ENTRIES is a buffer for one bucket. */
+static bool
+overflow_needed (const struct dir *dir, off_t bucket,
+                 struct dir_entry *entries)
+{
+  off_t ofs;
+  size_t i;
+
+  for (ofs = next_bucket (bucket); ofs != bucket; ofs = next_bucket (ofs))
+    {
+      if (!read_bucket (dir, ofs, entries))
+        return true;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (entries[i].in_use)
+          {
+            off_t home = home_bucket (entries[i].name);
+            if (bucket_distance (home, bucket) < bucket_distance (home, ofs))
+              return true;
+          }
+      if (!entries[0].overflow)
+        return false;
+    }
+  return true;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -39,6 +122,7 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      inode_set_journaled (inode);
       return dir;
     }
   else
@@ -92,23 +176,57 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_entry *entries;
+  off_t bucket = home_bucket (name);
+  size_t probes, i;
+  bool found = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  entries = malloc (BUCKET_SIZE);
+  if (entries == NULL)
+    return false;
+  for (probes = 0; probes < DIR_BUCKETS && !found; probes++)
+    {
+      if (!read_bucket (dir, bucket, entries))
+        break;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (entries[i].in_use && !strcmp (name, entries[i].name)) 
+          {
+            if (ep != NULL)
+              *ep = entries[i];
+            if (ofsp != NULL)
+              *ofsp = bucket + i * sizeof *entries;
+            found = true;
+            break;
+          }
+      if (!entries[0].overflow)
+        break;
+      bucket = next_bucket (bucket);
+    }
+  free (entries);
+  return found;
+}
+
+/* Returns the sector of the inode of the file named NAME in DIR,
+   or DCACHE_NEGATIVE if there is none.  Asks the name cache first,
+   and caches what it finds on disk.  DIR's inode must be locked,
+   so that what it caches is not out of date. */
+static block_sector_t
+cached_lookup (const struct dir *dir, const char *name)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  block_sector_t sector;
+  struct dir_entry e;
+
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector
+                                            : DCACHE_NEGATIVE;
+      dcache_insert (dir_sector, name, sector);
+    }
+  return sector;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -119,13 +237,16 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  inode_lock (dir->inode);
+  sector = cached_lookup (dir, name);
+  inode_unlock (dir->inode);
+  if (sector != DCACHE_NEGATIVE)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
 
@@ -141,8 +262,10 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_entry *entries;
   struct dir_entry e;
-  off_t ofs;
+  off_t bucket, ofs;
+  size_t probes;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,32 +275,82 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  entries = malloc (BUCKET_SIZE);
+  if (entries == NULL)
+    return false;
+  inode_lock (dir->inode);
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (cached_lookup (dir, name) != DCACHE_NEGATIVE)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Set OFS to offset of a free slot in NAME's bucket, or in the
+     first bucket after it with one, marking full buckets on the way
+     as overflowing.  The slot keeps its OVERFLOW flag. */
+  bucket = home_bucket (name);
+  for (probes = 0; ; probes++)
+    {
+      size_t i;
+
+      if (probes == DIR_BUCKETS || !read_bucket (dir, bucket, entries))
+        goto done;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (!entries[i].in_use)
+          break;
+      if (i < BUCKET_ENTRIES)
+        {
+          e = entries[i];
+          ofs = bucket + i * sizeof e;
+          break;
+        }
+
+      /* Bucket is full. */
+      if (!entries[0].overflow)
+        {
+          entries[0].overflow = true;
+          if (inode_write_at (dir->inode, &entries[0], sizeof e, bucket)
+              != sizeof e)
+            goto done;
+        }
+      bucket = next_bucket (bucket);
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  inode_unlock (dir->inode);
+  free (entries);
   return success;
 }
 
+/* Clears the OVERFLOW flag of each bucket in DIR from FIRST up to
+   but not including LAST that no longer needs it.  DIR's inode
+   must be locked. */
+static void
+clear_overflow (struct dir *dir, off_t first, off_t last)
+{
+  struct dir_entry *entries = malloc (BUCKET_SIZE);
+  struct dir_entry e;
+  off_t bucket;
+
+  if (entries == NULL)
+    return;
+  for (bucket = first; bucket != last; bucket = next_bucket (bucket))
+    if (inode_read_at (dir->inode, &e, sizeof e, bucket) == sizeof e
+        && e.overflow && !overflow_needed (dir, bucket, entries))
+      {
+        e.overflow = false;
+        inode_write_at (dir->inode, &e, sizeof e, bucket);
+      }
+  free (entries);
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
    which occurs only if there is no file with the given NAME. */
@@ -187,11 +360,13 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  off_t ofs, bucket;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -206,31 +381,58 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
-  /* Remove inode. */
+  /* If the entry overflowed its home bucket, the buckets it passed
+     over may no longer need to send lookups on. */
+  bucket = ROUND_DOWN (ofs, BUCKET_SIZE);
+  if (bucket != home_bucket (name))
+    clear_overflow (dir, home_bucket (name), bucket);
+
+  /* Remove inode, and forget its name and, if it is a directory,
+     the names in it. */
   inode_remove (inode);
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+  dcache_invalidate_dir (e.inode_sector);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Reads a bucket at a time, and skips
+   buckets that are holes without reading them. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_entry *entries = malloc (BUCKET_SIZE);
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (entries == NULL)
+    return false;
+  while (!found) 
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      off_t bucket;
+      size_t i;
+
+      if (dir->pos % BUCKET_SIZE == 0)
+        dir->pos = inode_next_data (dir->inode, dir->pos);
+      bucket = ROUND_DOWN (dir->pos, BUCKET_SIZE);
+      if (!read_bucket (dir, bucket, entries))
+        break;
+      for (i = (dir->pos - bucket) / sizeof *entries;
+           i < BUCKET_ENTRIES && !found; i++)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          dir->pos += sizeof *entries;
+          if (entries[i].in_use)
+            {
+              strlcpy (name, entries[i].name, NAME_MAX + 1);
+              found = true;
+            }
+        }
     }
-  return false;
+  free (entries);
+  return found;
 }
@@ -9,8 +9,15 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_pos;               /* Where a sequential read would start. */
+    off_t ra_end;               /* End of read-ahead issued so far. */
   };
 
+/* Bytes to read ahead of a sequential reader. */
+#define READAHEAD_BYTES (8 * BLOCK_SECTOR_SIZE)
+
+static void file_readahead (struct file *, off_t offset, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +30,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_pos = 0;
+      file->ra_end = 0;
       return file;
     }
   else
@@ -69,6 +78,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +91,39 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_readahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Called after BYTES_READ bytes were read from FILE at OFFSET.  If
+   the read continued where the previous one left off, queues the
+   next READAHEAD_BYTES of the file to be read into the buffer
+   cache in the background, skipping any already queued. */
+static void
+file_readahead (struct file *file, off_t offset, off_t bytes_read)
+{
+  off_t end = offset + bytes_read;
+  bool sequential = offset == file->ra_pos && bytes_read > 0;
+
+  file->ra_pos = end;
+  if (!sequential)
+    {
+      file->ra_end = end;
+      return;
+    }
+
+  off_t start = file->ra_end > end ? file->ra_end : end;
+  file->ra_end = end + READAHEAD_BYTES;
+  if (start < file->ra_end)
+    inode_readahead (file->inode, start, file->ra_end - start);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +136,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -2,17 +2,18 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
-
-#include "threads/synch.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
-struct lock lock;
+bool filesys_extents;
 
 static void do_format (void);
 
@@ -25,15 +26,23 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_init (format);
   free_map_open ();
 
-  lock_init (&lock);
+  /* New files take the format the file system was created in. */
+  struct inode *root = inode_open (ROOT_DIR_SECTOR);
+  if (root == NULL)
+    PANIC ("can't open root directory");
+  inode_set_extents (inode_uses_extents (root));
+  inode_close (root);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -41,7 +50,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_commit ();
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -52,14 +63,17 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
+  journal_begin ();
   struct dir *dir = dir_open_root ();
+  /* Put the inode near its directory's, the root directory's. */
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (ROOT_DIR_SECTOR, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -89,9 +103,18 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
+  struct inode *inode = NULL;
+
+  /* Keep the file open until the operation ends, so that the last
+     close, which frees its sectors in operations of its own, does
+     not happen within this one. */
+  journal_begin ();
   struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  bool success = (dir != NULL && dir_lookup (dir, name, &inode)
+                  && dir_remove (dir, name));
   dir_close (dir); 
+  journal_end ();
+  inode_close (inode);
 
   return success;
 }
@@ -101,21 +124,10 @@ static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  inode_set_extents (filesys_extents);
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
 }
-
-void
-filesys_acquire ()
-{
-  lock_acquire (&lock);
-}
-
-void
-filesys_release ()
-{
-  lock_release(&lock);
-}
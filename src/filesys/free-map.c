@@ -1,22 +1,46 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors per allocation group: as many as one sector of the free
+   map describes.  Allocation keeps related sectors in the same
+   group and passes over groups that are full. */
+#define GROUP_SECTORS (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map. */
+static block_sector_t next_sector;   /* Where the next scan starts. */
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+static void count_free (void);
+static void set_sectors (block_sector_t, size_t cnt, bool used);
+static block_sector_t scan_and_flip (block_sector_t start, size_t cnt);
+static bool commit_allocation (block_sector_t, size_t, block_sector_t *);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  group_cnt = DIV_ROUND_UP (block_size (fs_device), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (free_map == NULL || group_free == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_free ();
+  lock_init (&free_map_lock);
+  next_sector = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,12 +51,193 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  block_sector_t sector = scan_and_flip (next_sector, cnt);
+  bool success = commit_allocation (sector, cnt, sectorp);
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates a single sector from the free map, the first free one
+   at or after HINT if there is one, so that sectors allocated in
+   turn for the same file end up next to each other.  Stores it
+   into *SECTORP.
+   Returns true if successful, false if the disk is full or if the
+   free_map file could not be written. */
+bool
+free_map_allocate_near (block_sector_t hint, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool success;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  sector = scan_and_flip (hint, 1);
+  success = commit_allocation (sector, 1, sectorp);
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates a run of up to CNT consecutive sectors from the free
+   map: the first run of all CNT free sectors at or after HINT,
+   wrapping around to the start of the disk, or failing that the
+   longest free run there is, so that a file grown a run at a time
+   is made of as few runs as possible.  Stores the first sector of
+   the run into *SECTORP.
+   Returns the number of sectors allocated, which is 0 if the disk
+   is full or if the free_map file could not be written. */
+size_t
+free_map_allocate_run (block_sector_t hint, size_t cnt,
+                       block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t best = BITMAP_ERROR;
+  size_t best_cnt = 0;
+  size_t i = hint < size ? hint : 0;
+  size_t scanned = 0;
+  bool success;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  while (scanned < size && best_cnt < cnt)
+    {
+      size_t run = 0;
+
+      if (i % GROUP_SECTORS == 0 && group_free[i / GROUP_SECTORS] == 0)
+        {
+          /* Skip the full group. */
+          size_t skip = size - i < GROUP_SECTORS ? size - i
+                                                 : GROUP_SECTORS;
+          i += skip;
+          scanned += skip;
+          if (i >= size)
+            i = 0;
+          continue;
+        }
+      while (run < cnt && i + run < size
+             && !bitmap_test (free_map, i + run))
+        run++;
+      if (run > best_cnt)
+        {
+          best = i;
+          best_cnt = run;
+        }
+
+      /* Skip the run, or the used sector, and wrap at the end. */
+      i += run > 0 ? run : 1;
+      scanned += run > 0 ? run : 1;
+      if (i >= size)
+        i = 0;
+    }
+
+  if (best_cnt > 0)
+    {
+      set_sectors (best, best_cnt, true);
+      next_sector = best + best_cnt;
+    }
+  success = commit_allocation (best, best_cnt, sectorp);
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success ? best_cnt : 0;
+}
+
+/* Finds CNT consecutive free sectors and marks them used: the
+   first such at or after START in START's group, or failing that
+   the first in the groups that follow, wrapping around to the
+   start of the disk and back to START's group.  Groups with too
+   few free sectors are not scanned at all.  A run longer than a
+   group, or one that only fits across the boundary between two
+   groups, is found by a plain scan of the whole free map, which
+   is the last resort.  Scans that have no better place to start
+   resume after the sectors found.  Returns the first sector, or
+   BITMAP_ERROR if there are none.  FREE_MAP_LOCK must be held. */
+static block_sector_t
+scan_and_flip (block_sector_t start, size_t cnt)
+{
+  size_t first, i;
+  size_t sector = BITMAP_ERROR;
+
+  if (start >= bitmap_size (free_map))
+    start = 0;
+  first = start / GROUP_SECTORS;
+  for (i = 0; i <= group_cnt && cnt <= GROUP_SECTORS; i++)
+    {
+      size_t group = (first + i) % group_cnt;
+      size_t from = group * GROUP_SECTORS;
+
+      if (group_free[group] < cnt)
+        continue;
+      if (i == 0)
+        from = start;
+      sector = bitmap_scan (free_map, from, cnt, false);
+      if (sector != BITMAP_ERROR && sector / GROUP_SECTORS == group)
+        break;
+      sector = BITMAP_ERROR;
+    }
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+
+  if (sector != BITMAP_ERROR)
+    {
+      set_sectors (sector, cnt, true);
+      next_sector = sector + cnt;
+    }
+  return sector;
+}
+
+/* Marks the CNT sectors starting at SECTOR used if USED is true,
+   free otherwise, and updates the free counts of their groups.
+   The sectors must all be in the other state.  FREE_MAP_LOCK must
+   be held. */
+static void
+set_sectors (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t i;
+
+  ASSERT (used ? bitmap_none (free_map, sector, cnt)
+          : bitmap_all (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  for (i = sector; i < sector + cnt; i++)
+    if (used)
+      group_free[i / GROUP_SECTORS]--;
+    else
+      group_free[i / GROUP_SECTORS]++;
+}
+
+/* Counts the free sectors in each group afresh. */
+static void
+count_free (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = size - start < GROUP_SECTORS ? size - start
+                                                : GROUP_SECTORS;
+      group_free[group] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Finishes allocating the CNT sectors starting at SECTOR, which
+   have been marked used in the free map, by writing the part of
+   the free map that changed as part of the running transaction.
+   SECTOR may be BITMAP_ERROR if the allocation failed.
+   On success, stores SECTOR into *SECTORP and returns true.
+   FREE_MAP_LOCK must be held. */
+static bool
+commit_allocation (block_sector_t sector, size_t cnt,
+                   block_sector_t *sectorp)
+{
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
+      set_sectors (sector, cnt, false);
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
@@ -44,9 +249,13 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  journal_begin ();
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  set_sectors (sector, cnt, false);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  lock_release (&free_map_lock);
+  journal_end ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,8 +265,10 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_journaled (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -76,10 +287,16 @@ free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The first write allocates the file's
+     sectors, which changes the bitmap as it is written, so write it
+     again once it is complete.  From then on, writing the free map
+     never allocates. */
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
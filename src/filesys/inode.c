@@ -1,23 +1,94 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identify an inode and its format: INODE_MAGIC for one that
+   finds its data sectors through pointers, EXTENT_MAGIC for one
+   that describes them as extents. */
 #define INODE_MAGIC 0x494e4f44
+#define EXTENT_MAGIC 0x494e4f45
+
+/* Number of data sector pointers of each kind in an inode.
+   Direct pointers name data sectors; the indirect pointer names a
+   sector of PTRS_PER_SECTOR data sector pointers, and the doubly
+   indirect pointer a sector of PTRS_PER_SECTOR indirect pointers.
+   A pointer of 0 means that no sector is allocated, since sector 0
+   always holds the free map inode.  Data sectors are allocated when
+   first written; until then they read as zeros. */
+#define DIRECT_CNT 124
+#define INDIRECT_CNT 1
+#define DBL_INDIRECT_CNT 1
+#define SECTOR_CNT (DIRECT_CNT + INDIRECT_CNT + DBL_INDIRECT_CNT)
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest file, in sectors. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* A run of COUNT consecutive sectors on disk, starting at START,
+   that holds the file's data sectors starting at LOGICAL. */
+struct extent
+  {
+    uint32_t logical;                   /* First data sector in file. */
+    block_sector_t start;               /* First sector on disk. */
+    uint32_t count;                     /* Number of sectors. */
+  };
+
+/* Number of entries in an inode's extent root, and in a leaf. */
+#define ROOT_EXTENTS 41
+#define LEAF_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+
+/* Most sectors allocated as one extent at a time. */
+#define MAX_RUN 1024
+
+/* Most sectors that allocating one data sector, or one extent,
+   logs: free map sectors for it and for up to three index or leaf
+   sectors, and those index or leaf sectors.  A run of MAX_RUN
+   sectors spans at most two free map sectors. */
+#define ALLOC_ROOM 8
+
+/* Most data sectors of a journaled inode written as one
+   operation. */
+#define PIECE_SECTORS 4
+
+/* Most sectors that releasing a run of up to MAX_RUN sectors logs:
+   the free map sectors that hold its bits. */
+#define RELEASE_ROOM 2
+
+/* Extents of an inode in the extent format, sorted by LOGICAL and
+   not overlapping.  Data sectors in no extent are unallocated.  At
+   depth 0, the entries are the extents themselves.  At depth 1,
+   each entry instead names a leaf sector in START holding COUNT
+   extents, the first of which begins at LOGICAL. */
+struct extent_root
+  {
+    uint32_t depth;                     /* 0 or 1. */
+    uint32_t cnt;                       /* Number of entries in use. */
+    struct extent extents[ROOT_EXTENTS];
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        block_sector_t sectors[SECTOR_CNT]; /* INODE_MAGIC: direct,
+                                               indirect, doubly
+                                               indirect pointers. */
+        struct extent_root root;        /* EXTENT_MAGIC: extents. */
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,44 +102,109 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    block_sector_t hint;                /* Where to allocate next sector. */
+    bool journaled;                     /* Journal data writes too? */
     struct inode_disk data;             /* Inode content. */
+    struct rwlock rwlock;               /* Protects the members above,
+                                           except OPEN_CNT. */
+    struct lock lock;                   /* See inode_lock(). */
   };
 
+static block_sector_t lookup_sector (struct inode_disk *, size_t idx);
+static block_sector_t index_lookup (struct inode_disk *, size_t idx,
+                                    bool create, block_sector_t *hint,
+                                    bool *changed);
+static block_sector_t extent_lookup (const struct inode_disk *,
+                                     size_t idx);
+static size_t index_next (const struct inode_disk *, size_t idx);
+static size_t extent_next (const struct inode_disk *, size_t idx);
+static size_t extent_allocate (struct inode_disk *, size_t idx,
+                               size_t cnt, block_sector_t *hint,
+                               bool *changed);
+static bool is_allocated (struct inode *, off_t offset, off_t size);
+static size_t allocate_range (struct inode_disk *, size_t idx, size_t cnt,
+                              block_sector_t *hint, int keep,
+                              bool *changed);
+static off_t write_piece (struct inode *, const uint8_t *, off_t size,
+                          off_t offset);
+static void release_sectors (block_sector_t, size_t cnt);
+static void deallocate (struct inode_disk *);
+static void extent_deallocate (struct inode_disk *);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns 0 if POS is in a hole, which reads as zeros, and -1 if
+   INODE does not contain data for a byte at offset POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return lookup_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, by sector, so that opening a single inode twice
+   returns the same `struct inode'.  OPEN_INODES_LOCK protects the
+   table and the inodes' OPEN_CNT fields. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Whether new inodes use the extent format. */
+static bool use_extents;
+
+/* A sector's worth of zeros. */
+static const char zeros[BLOCK_SECTOR_SIZE];
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+}
+
+/* Makes inodes created from now on use the extent format if
+   EXTENTS is true, or index their sectors through pointers if it
+   is false. */
+void
+inode_set_extents (bool extents)
+{
+  use_extents = extents;
+}
+
+/* Returns true if INODE is in the extent format. */
+bool
+inode_uses_extents (const struct inode *inode)
+{
+  return inode->data.magic == EXTENT_MAGIC;
+}
+
+/* Makes writes to INODE's data go through the journal, like those
+   to its inode and index sectors, for an inode whose data is
+   itself metadata: a directory or the free map. */
+void
+inode_set_journaled (struct inode *inode)
+{
+  inode->journaled = true;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is all one hole, so this takes no disk space
+   or time in proportion to LENGTH.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   large. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
@@ -84,20 +220,11 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->magic = use_extents ? EXTENT_MAGIC : INODE_MAGIC;
+      if (use_extents || bytes_to_sectors (length) <= MAX_SECTORS) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          journal_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
       free (disk_inode);
@@ -111,20 +238,22 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  lock_release (&open_inodes_lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -132,12 +261,26 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->hint = sector;
+  inode->journaled = false;
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
+
+  /* Someone else may have opened it while we read it. */
+  lock_acquire (&open_inodes_lock);
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +289,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -168,17 +315,23 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  bool last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed.  This may take several
+         operations, which need not be atomic together, since
+         nothing on disk refers to a removed inode any more. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin ();
+          release_sectors (inode->sector, 1);
+          deallocate (&inode->data);
+          journal_end ();
         }
 
       free (inode); 
@@ -194,16 +347,33 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Acquires INODE's lock, which its users may hold to make a
+   series of operations on INODE atomic.  Directories hold it while
+   they look up and change names. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Any number of threads may read INODE at once. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,50 +390,134 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up.  A write past end of file
+   extends the inode, leaving a hole in any gap.
+   Writes within the allocated part of INODE may proceed alongside
+   reads and other such writes; writes that allocate or extend
+   INODE have it to themselves, and are journaled, as are all
+   writes to a journaled INODE.  A write too large for one
+   journaled operation is made in pieces, each an operation of its
+   own. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+
+  while (size > 0)
+    {
+      off_t chunk = write_piece (inode, buffer + bytes_written, size,
+                                 offset);
+      if (chunk == 0)
+        break;
+
+      /* Advance. */
+      size -= chunk;
+      offset += chunk;
+      bytes_written += chunk;
+    }
+  return bytes_written;
+}
+
+/* Writes a leading piece of the SIZE bytes from BUFFER into INODE
+   at OFFSET, as inode_write_at() does, as at most one journaled
+   operation.  Returns the number of bytes written, which is 0 only
+   if the disk is full or writes to INODE are denied. */
+static off_t
+write_piece (struct inode *inode, const uint8_t *buffer, off_t size,
+             off_t offset)
+{
+  off_t bytes_written = 0;
+  bool exclusive = false;
+  bool transaction = inode->journaled;
+
+  /* A journaled write logs each sector it writes, so it must
+     leave room for them. */
+  if (inode->journaled)
+    {
+      off_t end = (ROUND_DOWN (offset, BLOCK_SECTOR_SIZE)
+                   + PIECE_SECTORS * BLOCK_SECTOR_SIZE);
+      if (offset + size > end)
+        size = end - offset;
+    }
+
+  /* A transaction must begin before taking INODE's rwlock. */
+  if (transaction)
+    journal_begin ();
+  rwlock_acquire_read (&inode->rwlock);
+  if (size > 0 && !is_allocated (inode, offset, size))
+    {
+      rwlock_release_read (&inode->rwlock);
+      if (!transaction)
+        {
+          journal_begin ();
+          transaction = true;
+        }
+      rwlock_acquire_write (&inode->rwlock);
+      exclusive = true;
+    }
 
   if (inode->deny_write_cnt)
-    return 0;
+    size = 0;
+  else if (exclusive)
+    {
+      /* Allocate the sectors to write that are still holes, and
+         grow to cover them, as far as the disk and the operation's
+         room in the journal allow.  The inode sector, and the data
+         sectors of a journaled inode, need room too. */
+      size_t first = offset / BLOCK_SECTOR_SIZE;
+      size_t cnt = bytes_to_sectors (offset + size) - first;
+      size_t last = first + cnt - 1;
+      int keep = 1 + (inode->journaled ? PIECE_SECTORS : 0);
+      bool first_hole, last_hole;
+      bool changed = false;
+      off_t end;
+
+      /* Newly allocated sectors hold whatever they last held, so
+         those that the write covers only partly must be zeroed.
+         Note which they may be. */
+      first_hole = (offset % BLOCK_SECTOR_SIZE != 0
+                    && lookup_sector (&inode->data, first) == 0);
+      last_hole = ((offset + size) % BLOCK_SECTOR_SIZE != 0
+                   && lookup_sector (&inode->data, last) == 0);
+
+      cnt = allocate_range (&inode->data, first, cnt, &inode->hint,
+                            keep, &changed);
+      end = (first + cnt) * BLOCK_SECTOR_SIZE;
+      if (end < offset + size)
+        size = end > offset ? end - offset : 0;
+      if (first_hole && cnt > 0)
+        cache_write (lookup_sector (&inode->data, first), zeros, 0,
+                     BLOCK_SECTOR_SIZE);
+      if (last_hole && last < first + cnt && !(first_hole && last == first))
+        cache_write (lookup_sector (&inode->data, last), zeros, 0,
+                     BLOCK_SECTOR_SIZE);
+      if (offset + size > inode->data.length)
+        {
+          inode->data.length = offset + size;
+          changed = true;
+        }
+      if (changed)
+        journal_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
 
   while (size > 0) 
     {
@@ -281,49 +535,99 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      if (inode->journaled)
+        journal_write (sector_idx, buffer + bytes_written, sector_ofs,
+                       chunk_size);
+      else
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (exclusive)
+    rwlock_release_write (&inode->rwlock);
+  else
+    rwlock_release_read (&inode->rwlock);
+  if (transaction)
+    journal_end ();
   return bytes_written;
 }
 
+/* Returns true if the SIZE bytes of INODE at OFFSET lie within its
+   length and in allocated sectors, so that writing them changes
+   only data.  INODE's rwlock must be held. */
+static bool
+is_allocated (struct inode *inode, off_t offset, off_t size)
+{
+  off_t pos;
+
+  if (offset + size > inode->data.length)
+    return false;
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < offset + size;
+       pos += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, pos) == 0)
+      return false;
+  return true;
+}
+
+/* Starts reading the sectors holding the SIZE bytes of INODE at
+   OFFSET into the buffer cache, in the background. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  off_t pos;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
+/* Returns the offset of the first byte at or after POS that lies
+   in an allocated sector of INODE, or INODE's length if there is
+   none, so that a reader can skip holes without reading them. */
+off_t
+inode_next_data (struct inode *inode, off_t pos)
+{
+  off_t next = inode_length (inode);
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (pos < inode_length (inode))
+    {
+      size_t idx = pos / BLOCK_SECTOR_SIZE;
+      size_t first = (inode->data.magic == EXTENT_MAGIC
+                      ? extent_next (&inode->data, idx)
+                      : index_next (&inode->data, idx));
+      if (first == idx)
+        next = pos;
+      else if (first < bytes_to_sectors (inode_length (inode)))
+        next = first * BLOCK_SECTOR_SIZE;
+    }
+  rwlock_release_read (&inode->rwlock);
+  return next;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +636,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +649,577 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Open inode hash function. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Open inode comparison function. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Allocates a sector near *HINT and stores it in *SECTORP.  On
+   success, updates *HINT to follow it.  An INDEX sector is
+   metadata, so it is zeroed through the journal.  A data sector is
+   left as it is, since the write that allocates it overwrites it,
+   and write_piece() zeroes any part of it that the write does not
+   cover. */
+static bool
+allocate_sector (block_sector_t *sectorp, block_sector_t *hint,
+                 bool index)
+{
+  if (!free_map_allocate_near (*hint, sectorp))
+    return false;
+  if (index)
+    journal_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  *hint = *sectorp + 1;
+  return true;
+}
+
+/* Returns pointer IDX in index sector INDEX.  If it is 0 and
+   CREATE is true, allocates a sector for it first, which is
+   another, zeroed, index sector if LEAF is false. */
+static block_sector_t
+index_entry (block_sector_t index, size_t idx, bool create, bool leaf,
+             block_sector_t *hint)
+{
+  block_sector_t sector;
+
+  cache_read (index, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && create && allocate_sector (&sector, hint, !leaf))
+    journal_write (index, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Returns the sector that holds data sector IDX of the inode
+   whose on-disk contents are DISK, or 0 if none is allocated. */
+static block_sector_t
+lookup_sector (struct inode_disk *disk, size_t idx)
+{
+  if (disk->magic == EXTENT_MAGIC)
+    return extent_lookup (disk, idx);
+  return index_lookup (disk, idx, false, NULL, NULL);
+}
+
+/* Returns the sector that holds data sector IDX of the inode
+   whose on-disk contents are DISK, which indexes its data sectors
+   through pointers, or 0 if none is allocated.
+   If CREATE is true, allocates it, and any index sectors leading
+   to it, near *HINT, and returns 0 only if the disk is full.
+   Sets *CHANGED to true if that changes DISK, even if it then
+   fails, since an index sector allocated on the way stays in use,
+   and the caller must then write DISK back. */
+static block_sector_t
+index_lookup (struct inode_disk *disk, size_t idx, bool create,
+              block_sector_t *hint, bool *changed)
+{
+  block_sector_t *top;
+
+  ASSERT (idx < MAX_SECTORS);
+  if (idx < DIRECT_CNT)
+    {
+      top = &disk->sectors[idx];
+      if (*top == 0 && create && allocate_sector (top, hint, false))
+        *changed = true;
+      return *top;
+    }
+
+  idx -= DIRECT_CNT;
+  if (idx < PTRS_PER_SECTOR)
+    top = &disk->sectors[DIRECT_CNT];
+  else
+    top = &disk->sectors[DIRECT_CNT + INDIRECT_CNT];
+  if (*top == 0)
+    {
+      if (!(create && allocate_sector (top, hint, true)))
+        return 0;
+      *changed = true;
+    }
+
+  if (idx < PTRS_PER_SECTOR)
+    return index_entry (*top, idx, create, true, hint);
+
+  idx -= PTRS_PER_SECTOR;
+  block_sector_t indirect = index_entry (*top, idx / PTRS_PER_SECTOR,
+                                        create, false, hint);
+  if (indirect == 0)
+    return 0;
+  return index_entry (indirect, idx % PTRS_PER_SECTOR, create, true,
+                      hint);
+}
+
+/* Returns the first of DISK's data sectors at or after IDX that is
+   allocated, or SIZE_MAX if there is none, for an inode that
+   indexes its data sectors through pointers.  Skips whole index
+   sectors that are holes.  Returns IDX if out of memory. */
+static size_t
+index_next (const struct inode_disk *disk, size_t idx)
+{
+  block_sector_t *ptrs, dbl;
+  size_t first = SIZE_MAX;
+
+  for (; idx < DIRECT_CNT; idx++)
+    if (disk->sectors[idx] != 0)
+      return idx;
+
+  ptrs = malloc (BLOCK_SECTOR_SIZE);
+  if (ptrs == NULL)
+    return idx;
+
+  /* Indirect pointers. */
+  if (idx < DIRECT_CNT + PTRS_PER_SECTOR)
+    {
+      if (disk->sectors[DIRECT_CNT] != 0)
+        {
+          cache_read (disk->sectors[DIRECT_CNT], ptrs, 0, BLOCK_SECTOR_SIZE);
+          for (; idx < DIRECT_CNT + PTRS_PER_SECTOR; idx++)
+            if (ptrs[idx - DIRECT_CNT] != 0)
+              {
+                first = idx;
+                goto done;
+              }
+        }
+      idx = DIRECT_CNT + PTRS_PER_SECTOR;
+    }
+
+  /* Doubly indirect pointers, a sector of pointers at a time. */
+  dbl = disk->sectors[DIRECT_CNT + INDIRECT_CNT];
+  while (dbl != 0 && idx < MAX_SECTORS)
+    {
+      size_t i = idx - DIRECT_CNT - PTRS_PER_SECTOR;
+      size_t end = idx + (PTRS_PER_SECTOR - i % PTRS_PER_SECTOR);
+      block_sector_t indirect;
+
+      cache_read (dbl, &indirect, i / PTRS_PER_SECTOR * sizeof indirect,
+                  sizeof indirect);
+      if (indirect != 0)
+        {
+          cache_read (indirect, ptrs, 0, BLOCK_SECTOR_SIZE);
+          for (; idx < end; idx++, i++)
+            if (ptrs[i % PTRS_PER_SECTOR] != 0)
+              {
+                first = idx;
+                goto done;
+              }
+        }
+      idx = end;
+    }
+
+ done:
+  free (ptrs);
+  return first;
+}
+
+/* Allocates those of DISK's data sectors IDX through IDX + CNT - 1
+   that are still holes, near *HINT, and sets *CHANGED to true if
+   that changes DISK, even if an allocation then fails partway, and
+   the caller must then write DISK back.  Allocates at least the
+   first hole, but no more once that would leave less than KEEP
+   sectors of the operation's journal room.  Returns how many of
+   the sectors, starting from IDX, are allocated, which is less
+   than CNT only if the disk, the inode, or the journal room is
+   full. */
+static size_t
+allocate_range (struct inode_disk *disk, size_t idx, size_t cnt,
+                block_sector_t *hint, int keep, bool *changed)
+{
+  size_t i, n;
+  bool allocated = false;
+
+  if (disk->magic == INODE_MAGIC && idx + cnt > MAX_SECTORS)
+    cnt = idx < MAX_SECTORS ? MAX_SECTORS - idx : 0;
+  for (i = 0; i < cnt; i += n)
+    {
+      n = 1;
+      if (lookup_sector (disk, idx + i) != 0)
+        continue;
+      if (allocated && journal_room () < ALLOC_ROOM + keep)
+        break;
+      allocated = true;
+
+      if (disk->magic == EXTENT_MAGIC)
+        {
+          /* Fill as much of the hole as one extent can. */
+          size_t hole = 1;
+          while (i + hole < cnt && hole < MAX_RUN
+                 && extent_lookup (disk, idx + i + hole) == 0)
+            hole++;
+          n = extent_allocate (disk, idx + i, hole, hint, changed);
+        }
+      else
+        n = index_lookup (disk, idx + i, true, hint, changed) != 0;
+      if (n == 0)
+        break;
+    }
+  return i;
+}
+
+/* Releases the index sector SECTOR, and if LEVEL > 0, the sectors
+   it points to, recursively to LEVEL levels. */
+static void
+release_index (block_sector_t sector, int level)
+{
+  if (level > 0)
+    {
+      block_sector_t *ptrs = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      if (ptrs == NULL)
+        return;
+      cache_read (sector, ptrs, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        if (ptrs[i] != 0)
+          release_index (ptrs[i], level - 1);
+      free (ptrs);
+    }
+  release_sectors (sector, 1);
+}
+
+/* Releases the CNT sectors starting at SECTOR, as part of freeing
+   a removed inode, MAX_RUN at a time.  Before each run, ends the
+   operation and goes on as a new one if it may have too little
+   journal room left.  The caller must release an index or leaf
+   sector only after the sectors it points to, since it may be
+   reused as soon as its operation ends. */
+static void
+release_sectors (block_sector_t sector, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_RUN ? cnt : MAX_RUN;
+
+      if (journal_room () < RELEASE_ROOM)
+        {
+          journal_end ();
+          journal_begin ();
+        }
+      free_map_release (sector, n);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Releases all of DISK's data and index sectors, in as many
+   operations as it takes.  The caller must be in an operation,
+   and not within another one. */
+static void
+deallocate (struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->magic == EXTENT_MAGIC)
+    {
+      extent_deallocate (disk);
+      return;
+    }
+  for (i = 0; i < SECTOR_CNT; i++)
+    if (disk->sectors[i] != 0)
+      {
+        int level = (i < DIRECT_CNT ? 0
+                     : i < DIRECT_CNT + INDIRECT_CNT ? 1 : 2);
+        release_index (disk->sectors[i], level);
+      }
+}
+
+/* Returns the index of the last of the CNT extents in EXTENTS that
+   begins at or before data sector IDX, or CNT if there is none. */
+static size_t
+extent_search (const struct extent *extents, size_t cnt, size_t idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  if (cnt == 0 || extents[0].logical > idx)
+    return cnt;
+
+  /* EXTENTS[LO] begins at or before IDX, EXTENTS[HI] after it. */
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extents[mid].logical <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Returns the sector that holds data sector IDX of the extent
+   format inode whose on-disk contents are DISK, or 0 if none is
+   allocated.  Takes time logarithmic in the number of extents. */
+static block_sector_t
+extent_lookup (const struct inode_disk *disk, size_t idx)
+{
+  const struct extent_root *root = &disk->root;
+  size_t i = extent_search (root->extents, root->cnt, idx);
+  struct extent e;
+
+  if (i == root->cnt)
+    return 0;
+  e = root->extents[i];
+  if (root->depth > 0)
+    {
+      /* Search the leaf where it sits in the cache.  Its first
+         extent begins at or before IDX. */
+      block_sector_t leaf = e.start;
+      size_t lo = 0, hi = e.count;
+
+      while (hi - lo > 1)
+        {
+          size_t mid = (lo + hi) / 2;
+          cache_read (leaf, &e, mid * sizeof e, sizeof e);
+          if (e.logical <= idx)
+            lo = mid;
+          else
+            hi = mid;
+        }
+      cache_read (leaf, &e, lo * sizeof e, sizeof e);
+    }
+  return idx - e.logical < e.count ? e.start + (idx - e.logical) : 0;
+}
+
+/* Returns the first data sector at or after IDX in the CNT sorted
+   extents in EXTENTS, or SIZE_MAX if there is none. */
+static size_t
+extents_next (const struct extent *extents, size_t cnt, size_t idx)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (extents[i].logical + extents[i].count > idx)
+      return extents[i].logical > idx ? extents[i].logical : idx;
+  return SIZE_MAX;
+}
+
+/* Returns the first of DISK's data sectors at or after IDX that is
+   allocated, or SIZE_MAX if there is none, for an inode in the
+   extent format.  Returns IDX if out of memory. */
+static size_t
+extent_next (const struct inode_disk *disk, size_t idx)
+{
+  const struct extent_root *root = &disk->root;
+  struct extent *leaf;
+  size_t first = SIZE_MAX;
+  size_t i;
+
+  if (root->depth == 0)
+    return extents_next (root->extents, root->cnt, idx);
+
+  leaf = malloc (BLOCK_SECTOR_SIZE);
+  if (leaf == NULL)
+    return idx;
+  for (i = 0; i < root->cnt && first == SIZE_MAX; i++)
+    if (i + 1 == root->cnt || root->extents[i + 1].logical > idx)
+      {
+        cache_read (root->extents[i].start, leaf, 0, BLOCK_SECTOR_SIZE);
+        first = extents_next (leaf, root->extents[i].count, idx);
+      }
+  free (leaf);
+  return first;
+}
+
+/* Returns true if extent B directly follows extent A, both in the
+   file and on disk, so that they can be one extent. */
+static bool
+extents_adjacent (const struct extent *a, const struct extent *b)
+{
+  return (a->logical + a->count == b->logical
+          && a->start + a->count == b->start);
+}
+
+/* Adds extent E to the *CNT sorted extents in EXTENTS, which has
+   room for MAX, merging it with its neighbors where they are
+   adjacent.  Returns false if there is no room. */
+static bool
+extent_insert_sorted (struct extent *extents, uint32_t *cnt, size_t max,
+                      const struct extent *e)
+{
+  size_t pos = extent_search (extents, *cnt, e->logical);
+  size_t i;
+
+  /* POS is the index where E belongs. */
+  pos = pos == *cnt ? 0 : pos + 1;
+  if (pos > 0 && extents_adjacent (&extents[pos - 1], e))
+    {
+      extents[pos - 1].count += e->count;
+      if (pos < *cnt && extents_adjacent (&extents[pos - 1], &extents[pos]))
+        {
+          extents[pos - 1].count += extents[pos].count;
+          for (i = pos + 1; i < *cnt; i++)
+            extents[i - 1] = extents[i];
+          (*cnt)--;
+        }
+      return true;
+    }
+  if (pos < *cnt && extents_adjacent (e, &extents[pos]))
+    {
+      extents[pos].logical = e->logical;
+      extents[pos].start = e->start;
+      extents[pos].count += e->count;
+      return true;
+    }
+
+  if (*cnt >= max)
+    return false;
+  for (i = *cnt; i > pos; i--)
+    extents[i] = extents[i - 1];
+  extents[pos] = *e;
+  (*cnt)++;
+  return true;
+}
+
+/* Adds extent E, which must not overlap any of DISK's extents, to
+   DISK.  Fills the root, then moves its extents into a leaf and
+   splits leaves as they fill.  Returns false if out of memory or
+   disk space, or if the root is full of leaves.  Sets *CHANGED to
+   true if DISK's root changes, which it may even on failure, since
+   new leaves stay in the tree. */
+static bool
+extent_insert (struct inode_disk *disk, const struct extent *e,
+               bool *changed)
+{
+  struct extent_root *root = &disk->root;
+  struct extent *leaf;
+  bool success = false;
+
+  if (root->depth == 0
+      && extent_insert_sorted (root->extents, &root->cnt, ROOT_EXTENTS, e))
+    {
+      *changed = true;
+      return true;
+    }
+
+  leaf = malloc (BLOCK_SECTOR_SIZE);
+  if (leaf == NULL)
+    return false;
+
+  if (root->depth == 0)
+    {
+      /* The root is full.  Move its extents into a leaf. */
+      block_sector_t sector;
+      if (!free_map_allocate_near (e->start, &sector))
+        goto done;
+      memcpy (leaf, root->extents, root->cnt * sizeof *leaf);
+      journal_write (sector, leaf, 0, BLOCK_SECTOR_SIZE);
+      root->extents[0].start = sector;
+      root->extents[0].count = root->cnt;
+      root->cnt = 1;
+      root->depth = 1;
+      *changed = true;
+    }
+
+  for (;;)
+    {
+      size_t r = extent_search (root->extents, root->cnt, e->logical);
+      struct extent *entry = &root->extents[r == root->cnt ? 0 : r];
+      uint32_t n = entry->count;
+      block_sector_t sector;
+      size_t split;
+
+      cache_read (entry->start, leaf, 0, BLOCK_SECTOR_SIZE);
+      if (extent_insert_sorted (leaf, &n, LEAF_EXTENTS, e))
+        {
+          journal_write (entry->start, leaf, 0, BLOCK_SECTOR_SIZE);
+          entry->logical = leaf[0].logical;
+          entry->count = n;
+          *changed = true;
+          success = true;
+          break;
+        }
+
+      /* The leaf is full.  Move its upper half into a new leaf
+         after it, then try again.  A file that grows at its end
+         moves just its last extent, so that leaves stay full. */
+      if (root->cnt >= ROOT_EXTENTS
+          || !free_map_allocate_near (e->start, &sector))
+        break;
+      r = entry - root->extents;
+      split = (r == root->cnt - 1u && e->logical > leaf[n - 1].logical
+               ? n - 1 : n / 2);
+      journal_write (sector, leaf + split, 0, (n - split) * sizeof *leaf);
+      memmove (entry + 2, entry + 1,
+               (root->cnt - r - 1) * sizeof *entry);
+      entry[1].logical = leaf[split].logical;
+      entry[1].start = sector;
+      entry[1].count = n - split;
+      entry->count = split;
+      root->cnt++;
+      *changed = true;
+    }
+
+ done:
+  free (leaf);
+  return success;
+}
+
+/* Allocates a run of up to CNT sectors, preferably near *HINT, to
+   hold DISK's data sectors starting at IDX, none of which may be
+   allocated yet.  The sectors are not zeroed, as allocate_sector()
+   explains.  Returns the number allocated, or 0 if the disk is
+   full.  Sets *CHANGED to true if it changes DISK, even if it then
+   fails, and the caller must then write DISK back. */
+static size_t
+extent_allocate (struct inode_disk *disk, size_t idx, size_t cnt,
+                 block_sector_t *hint, bool *changed)
+{
+  struct extent e;
+
+  if (cnt > MAX_RUN)
+    cnt = MAX_RUN;
+  e.logical = idx;
+  e.count = free_map_allocate_run (*hint, cnt, &e.start);
+  if (e.count == 0)
+    return 0;
+  if (!extent_insert (disk, &e, changed))
+    {
+      free_map_release (e.start, e.count);
+      return 0;
+    }
+
+  *hint = e.start + e.count;
+  return e.count;
+}
+
+/* Releases the N extents in EXTENTS. */
+static void
+release_extents (const struct extent *extents, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    release_sectors (extents[i].start, extents[i].count);
+}
+
+/* Releases all of DISK's data and leaf sectors, for an inode in
+   the extent format. */
+static void
+extent_deallocate (struct inode_disk *disk)
+{
+  const struct extent_root *root = &disk->root;
+  struct extent *leaf;
+  size_t i;
+
+  if (root->depth == 0)
+    {
+      release_extents (root->extents, root->cnt);
+      return;
+    }
+
+  leaf = malloc (BLOCK_SECTOR_SIZE);
+  if (leaf == NULL)
+    return;
+  for (i = 0; i < root->cnt; i++)
+    {
+      cache_read (root->extents[i].start, leaf, 0, BLOCK_SECTOR_SIZE);
+      release_extents (leaf, root->extents[i].count);
+      release_sectors (root->extents[i].start, 1);
+    }
+  free (leaf);
+}
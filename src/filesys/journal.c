@@ -0,0 +1,269 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* The running transaction commits at least this often, in timer
+   ticks, which bounds how much is lost in a crash. */
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* Journal header, in sector JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   If CNT is nonzero, the CNT sectors that follow the header hold
+   the new contents of sectors SECTORS[], which may not all have
+   reached their homes. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t seq;                       /* Transactions committed. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    block_sector_t sectors[JOURNAL_MAX]; /* Home of each logged sector. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12 - JOURNAL_MAX * 4];
+  };
+
+/* The running transaction: every operation since the last commit.
+   SECTORS[] lists the sectors it has written, which stay pinned in
+   the cache until it commits. */
+static struct journal_header header;
+
+/* Protects HEADER, HANDLE_CNT, RESERVED, and COMMITTING. */
+static struct lock journal_lock;
+static struct condition ended;  /* Signaled when an operation ends. */
+static struct condition done;   /* Signaled when a commit finishes. */
+
+static size_t handle_cnt;       /* Operations under way. */
+static size_t reserved;         /* Room they have reserved but not used;
+                                   HEADER.CNT + RESERVED <= JOURNAL_MAX. */
+static bool committing;         /* Waiting for operations, or writing? */
+static bool enabled;            /* False until journal_init(). */
+
+/* New contents of the sectors being committed. */
+static uint8_t log_buf[JOURNAL_MAX * BLOCK_SECTOR_SIZE];
+
+static void recover (void);
+static void commit (void);
+static thread_func commit_daemon NO_RETURN;
+
+/* Initializes the journal.  If FORMAT is true, starts with an empty
+   journal, and otherwise replays the transaction, if any, that was
+   committed but may not have reached its home sectors before the
+   system stopped. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&ended);
+  cond_init (&done);
+  if (format)
+    {
+      header.magic = JOURNAL_MAGIC;
+      header.seq = 0;
+      header.cnt = 0;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+    }
+  else
+    recover ();
+  enabled = true;
+  thread_create ("journal", PRI_MIN, commit_daemon, NULL);
+}
+
+/* Begins an operation, which then commits atomically as part of
+   the running transaction.  Reserves JOURNAL_OP_MAX sectors of the
+   transaction for the operation, waiting for other operations to
+   end, or committing, until there is room.  Operations nest: only
+   the outermost journal_end() ends one.  Must be called before
+   acquiring any lock that an operation in progress may wait for. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || header.cnt + reserved + JOURNAL_OP_MAX > JOURNAL_MAX)
+    if (committing)
+      cond_wait (&done, &journal_lock);
+    else if (header.cnt + JOURNAL_OP_MAX > JOURNAL_MAX)
+      commit ();
+    else
+      cond_wait (&ended, &journal_lock);
+  handle_cnt++;
+  reserved += JOURNAL_OP_MAX;
+  t->journal_room = JOURNAL_OP_MAX;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation begun by journal_begin(), returning the room
+   it did not use. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  handle_cnt--;
+  reserved -= t->journal_room;
+  t->journal_room = 0;
+  cond_broadcast (&ended, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Returns the number of sectors the current operation may still
+   log, so that a large operation can stop and continue as
+   another.  Without a journal, there is no limit. */
+int
+journal_room (void)
+{
+  return enabled ? thread_current ()->journal_room : JOURNAL_OP_MAX;
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR, as
+   cache_write() does, as part of the running transaction.  The
+   sector reaches its home on disk only after the transaction
+   commits.  A sector new to the transaction takes room from the
+   operation's reservation, or if that is used up, from room that
+   no operation has reserved.  Panics if there is none, since the
+   operation then logged more than any may. */
+void
+journal_write (block_sector_t sector, const void *buffer, int ofs,
+               int size)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  if (!enabled)
+    {
+      cache_write (sector, buffer, ofs, size);
+      return;
+    }
+
+  journal_begin ();
+  lock_acquire (&journal_lock);
+  for (i = 0; i < header.cnt; i++)
+    if (header.sectors[i] == sector)
+      break;
+  if (i == header.cnt)
+    {
+      if (t->journal_room > 0)
+        {
+          t->journal_room--;
+          reserved--;
+        }
+      else if (header.cnt + reserved >= JOURNAL_MAX)
+        PANIC ("journal overflow: operation logged over %d sectors",
+               JOURNAL_OP_MAX);
+      header.sectors[header.cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+
+  cache_write_pinned (sector, buffer, ofs, size);
+  journal_end ();
+}
+
+/* Commits the running transaction, waiting for the operations
+   under way to end first.  The caller must not be in an
+   operation. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (committing)
+    cond_wait (&done, &journal_lock);
+  else
+    commit ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  All of its sectors go to the
+   log, then the header that lists them, which is the commit
+   point, and then to their homes.  JOURNAL_LOCK must be held. */
+static void
+commit (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (!committing);
+
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&ended, &journal_lock);
+
+  if (header.cnt > 0)
+    {
+      for (i = 0; i < header.cnt; i++)
+        cache_read (header.sectors[i], log_buf + i * BLOCK_SECTOR_SIZE,
+                    0, BLOCK_SECTOR_SIZE);
+      block_write_multiple (fs_device, JOURNAL_SECTOR + 1, header.cnt,
+                            log_buf);
+      header.seq++;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+
+      for (i = 0; i < header.cnt; i++)
+        cache_unpin (header.sectors[i]);
+      cache_flush ();
+      header.cnt = 0;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+    }
+
+  committing = false;
+  cond_broadcast (&done, &journal_lock);
+}
+
+/* Copies the committed transaction in the log, if any, to its
+   home sectors, and empties the log. */
+static void
+recover (void)
+{
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("journal header corrupted");
+
+  if (header.cnt > 0)
+    {
+      if (header.cnt > JOURNAL_MAX)
+        PANIC ("journal header corrupted");
+      printf ("journal: replaying %u sectors\n", header.cnt);
+      block_read_multiple (fs_device, JOURNAL_SECTOR + 1, header.cnt,
+                           log_buf);
+      for (i = 0; i < header.cnt; i++)
+        block_write (fs_device, header.sectors[i],
+                     log_buf + i * BLOCK_SECTOR_SIZE);
+      header.cnt = 0;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+    }
+}
+
+/* Every COMMIT_INTERVAL ticks, commits the running transaction,
+   so that many operations commit together. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      journal_commit ();
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Most sectors one transaction logs. */
+#define JOURNAL_MAX 32
+
+/* Most sectors one operation logs.  journal_begin() reserves this
+   much room in the running transaction. */
+#define JOURNAL_OP_MAX 16
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR:
+   a header, then the log. */
+#define JOURNAL_SECTORS (1 + JOURNAL_MAX)
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *, int ofs, int size);
+int journal_room (void);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,62 @@
+/* Child process for syn-contend test.
+   Reads its own file and the shared file by turns, a chunk at a
+   time, several times over, so that all the children are in the
+   kernel file system code at once. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-contend.h"
+
+const char *test_name = "child-syn-contend";
+
+#define ROUNDS 4
+
+static char own_buf[BUF_SIZE];
+static char shared_buf[BUF_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char own_name[16];
+  char chunk[CHUNK_SIZE];
+  int child_idx;
+  int own_fd, shared_fd;
+  size_t ofs;
+  int round;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (own_name, sizeof own_name, "data%d", child_idx);
+
+  random_init (0);
+  random_bytes (shared_buf, sizeof shared_buf);
+  random_init (child_idx + 1);
+  random_bytes (own_buf, sizeof own_buf);
+
+  CHECK ((own_fd = open (own_name)) > 1, "open \"%s\"", own_name);
+  CHECK ((shared_fd = open (shared_name)) > 1, "open \"%s\"", shared_name);
+  for (round = 0; round < ROUNDS; round++)
+    {
+      seek (own_fd, 0);
+      seek (shared_fd, 0);
+      for (ofs = 0; ofs < BUF_SIZE; ofs += CHUNK_SIZE)
+        {
+          CHECK (read (own_fd, chunk, CHUNK_SIZE) == CHUNK_SIZE,
+                 "read \"%s\"", own_name);
+          compare_bytes (chunk, own_buf + ofs, CHUNK_SIZE, ofs, own_name);
+          CHECK (read (shared_fd, chunk, CHUNK_SIZE) == CHUNK_SIZE,
+                 "read \"%s\"", shared_name);
+          compare_bytes (chunk, shared_buf + ofs, CHUNK_SIZE, ofs,
+                         shared_name);
+        }
+    }
+  close (own_fd);
+  close (shared_fd);
+
+  return child_idx;
+}
@@ -0,0 +1,51 @@
+/* Spawns 8 child processes that read at the same time, each from a
+   file of its own and all from one shared file, a chunk at a time,
+   and make sure that the contents are what they should be.  With
+   locking per inode rather than for the whole file system, readers
+   of different files, and of the same file, do not wait for each
+   other. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/syn-contend.h"
+
+static char buf[BUF_SIZE];
+
+/* Creates file NAME and fills it with random bytes from SEED. */
+static void
+make_file (const char *name, unsigned seed)
+{
+  int fd;
+
+  random_init (seed);
+  random_bytes (buf, sizeof buf);
+  CHECK (create (name, sizeof buf), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char name[16];
+  int i;
+
+  quiet = true;
+  make_file (shared_name, 0);
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (name, sizeof name, "data%d", i);
+      make_file (name, i + 1);
+    }
+  quiet = false;
+  msg ("created files");
+
+  exec_children ("child-syn-contend", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-contend) begin
+(syn-contend) created files
+(syn-contend) exec child 1 of 8: "child-syn-contend 0"
+(syn-contend) exec child 2 of 8: "child-syn-contend 1"
+(syn-contend) exec child 3 of 8: "child-syn-contend 2"
+(syn-contend) exec child 4 of 8: "child-syn-contend 3"
+(syn-contend) exec child 5 of 8: "child-syn-contend 4"
+(syn-contend) exec child 6 of 8: "child-syn-contend 5"
+(syn-contend) exec child 7 of 8: "child-syn-contend 6"
+(syn-contend) exec child 8 of 8: "child-syn-contend 7"
+(syn-contend) wait for child 1 of 8 returned 0 (expected 0)
+(syn-contend) wait for child 2 of 8 returned 1 (expected 1)
+(syn-contend) wait for child 3 of 8 returned 2 (expected 2)
+(syn-contend) wait for child 4 of 8 returned 3 (expected 3)
+(syn-contend) wait for child 5 of 8 returned 4 (expected 4)
+(syn-contend) wait for child 6 of 8 returned 5 (expected 5)
+(syn-contend) wait for child 7 of 8 returned 6 (expected 6)
+(syn-contend) wait for child 8 of 8 returned 7 (expected 7)
+(syn-contend) end
+EOF
+pass;
@@ -0,0 +1,12 @@
+#ifndef TESTS_FILESYS_BASE_SYN_CONTEND_H
+#define TESTS_FILESYS_BASE_SYN_CONTEND_H
+
+#define CHILD_CNT 8
+#define CHUNK_SIZE 512
+#define BUF_SIZE (8 * CHUNK_SIZE)
+static const char shared_name[] = "shared";
+
+/* File I is filled with random bytes from seed I + 1, and the
+   shared file from seed 0. */
+
+#endif /* tests/filesys/base/syn-contend.h */
@@ -0,0 +1,64 @@
+/* Keeps a small, hot working set busy while repeatedly streaming
+   through a cold buffer that is larger than physical memory, and
+   verifies that both hold the values they should.
+
+   The hot pages are written constantly, the cold pages are only
+   written once, so a page replacement policy that keeps the hot
+   set resident and prefers evicting clean pages needs few swap
+   writes.  page-hot-cold.ck reports the number of sectors
+   written to swap so that policies can be compared.
+
+   Each hot page holds an int counter, which never wraps back to
+   its starting value, so a hot page whose writes are lost and
+   that reads back as zeros is caught after every pass. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define HOT_SIZE (64 * 1024)
+#define COLD_SIZE (2 * 1024 * 1024)
+#define PASS_CNT 4
+
+/* Ints per page, and the number of hot increments per pass. */
+#define PAGE_INTS (PAGE_SIZE / sizeof (int))
+#define HOT_STEPS (COLD_SIZE / PAGE_SIZE)
+
+static int hot[HOT_SIZE / sizeof (int)];
+static char cold[COLD_SIZE];
+
+void
+test_main (void)
+{
+  size_t cold_ofs, hot_ofs;
+  int pass;
+
+  msg ("initialize");
+  memset (cold, 0x5a, sizeof cold);
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      msg ("pass %d", pass);
+      for (cold_ofs = 0; cold_ofs < COLD_SIZE; cold_ofs += PAGE_SIZE)
+        {
+          if (cold[cold_ofs] != 0x5a)
+            fail ("cold byte %zu != 0x5a", cold_ofs);
+          for (hot_ofs = 0; hot_ofs < HOT_SIZE / sizeof (int);
+               hot_ofs += PAGE_INTS)
+            hot[hot_ofs]++;
+        }
+
+      for (hot_ofs = 0; hot_ofs < HOT_SIZE / sizeof (int);
+           hot_ofs += PAGE_INTS)
+        if (hot[hot_ofs] != (int) ((pass + 1) * HOT_STEPS))
+          fail ("hot page %zu is %d after pass %d, not %d",
+                hot_ofs / PAGE_INTS, hot[hot_ofs], pass,
+                (int) ((pass + 1) * HOT_STEPS));
+    }
+
+  msg ("check hot pages");
+  for (hot_ofs = 0; hot_ofs < HOT_SIZE / sizeof (int); hot_ofs += PAGE_INTS)
+    if (hot[hot_ofs] != (int) (PASS_CNT * HOT_STEPS))
+      fail ("hot page %zu has wrong value", hot_ofs / PAGE_INTS);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-hot-cold) begin
+(page-hot-cold) initialize
+(page-hot-cold) pass 0
+(page-hot-cold) pass 1
+(page-hot-cold) pass 2
+(page-hot-cold) pass 3
+(page-hot-cold) check hot pages
+(page-hot-cold) end
+EOF
+
+our ($test);
+my ($writes) = map (/\(swap\): \d+ reads, (\d+) writes/,
+		    read_text_file ("$test.output"));
+fail "No swap statistics in output.\n" if !defined $writes;
+pass "$writes sectors written to swap";
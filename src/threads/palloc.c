@@ -148,6 +148,18 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the address of the first page in the user pool and
+   stores the number of pages in the user pool into *PAGE_CNT.
+   Every page returned by palloc_get_page (PAL_USER) lies in
+   this range, so callers may index per-page data by
+   pg_no (page) - pg_no (base). */
+void *
+palloc_user_pool (size_t *page_cnt)
+{
+  *page_cnt = bitmap_size (user_pool.used_map);
+  return user_pool.base;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
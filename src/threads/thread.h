@@ -113,6 +113,14 @@ struct thread
     struct hash page_table;             /* Hash table for supplemental page table. */
     void *esp;                          /* esp register value at fault time. */
     struct list mappings;               /* List of mappings. */
+    void *ra_next;                      /* Swap fault that would be sequential. */
+    void *ra_start;                     /* First page of last swap read-ahead. */
+    size_t ra_cnt;                      /* Pages in last swap read-ahead. */
+    size_t ra_window;                   /* Swap read-ahead window, in pages. */
+    int journal_depth;                  /* Nesting of file system
+                                           transactions. */
+    int journal_room;                   /* Sectors left in the journal
+                                           reservation. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -150,10 +150,13 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  // Check if memory address is paged.
-  if (user && not_present) {
+  // Check if memory address is paged.  A write to a present page
+  // may be the first write to a page mapped to the zero frame.
+  // System calls pin user buffers before touching them, so a fault
+  // in the kernel is always a bug.
+  if (user && (not_present || write)) {
     thread_current ()->esp = f->esp;
-    if (!page_load (fault_addr))
+    if (!page_load (fault_addr, write))
       sys_exit (-1);
     else
       return;
@@ -49,9 +49,7 @@ process_execute (const char *cmdline)
   file_name = strtok_r (file_name, " ", &args);
 
   /* Ensure file from file_name exists. */
-  filesys_acquire ();
   struct file *file = filesys_open (file_name);
-  filesys_release ();
   if (file == NULL)
     goto error_occured;
   file_close (file);
@@ -288,9 +286,7 @@ load (char *cmdline, void (**eip) (void), void **esp)
   file_name = strtok_r (file_name, " ", &args);
 
   /* Open executable file. */
-  filesys_acquire ();
   t->executable = file = filesys_open (file_name);
-  filesys_release ();
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
@@ -534,7 +530,7 @@ static bool
 setup_stack (void **esp, char *cmdline) 
 {
   thread_current ()->esp = PHYS_BASE - PGSIZE; // simulate a page fault addr  
-  if (!page_load (((uint8_t *) PHYS_BASE) - PGSIZE))
+  if (!page_load (((uint8_t *) PHYS_BASE) - PGSIZE, true))
     return false;
   *esp = PHYS_BASE;
 
@@ -10,11 +10,12 @@
 #include "filesys/filesys.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
-#include "userprog/pagedir.h"
 #include "userprog/process.h"
 
+#include <round.h>
 #include <string.h>
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "vm/frame.h"
 #include "vm/mapid_t.h"
 #include "vm/page.h"
@@ -26,18 +27,11 @@ struct fd
     struct list_elem elem;
   };
 
-struct mapping
-  {
-    mapid_t mapid;
-    struct file *file;
-    struct list mapped_pages;
-    struct list_elem elem;
-  };
-
 static void syscall_handler (struct intr_frame *);
 static void fetch_args (struct intr_frame *f, int *argv, int num);
 struct file* fetch_file (int fd_to_find);
-static void validate_addr (const void *addr);
+static void copy_in (void *dst, const void *usrc, size_t size);
+static char *copy_in_string (const char *us);
 static void free_mapping (struct mapping *mapping);
 
 /* Syscall implementations. */
@@ -63,9 +57,12 @@ syscall_init (void)
 static void
 syscall_handler (struct intr_frame *f) 
 {
-  validate_addr (f->esp);
+  /* For stack growth when a buffer is pinned below. */
+  thread_current ()->esp = f->esp;
+
   int argv[3]; // we expect at most 3 args and define as such to users
-  uint32_t syscall_num = *(uint32_t*)f->esp;
+  uint32_t syscall_num;
+  copy_in (&syscall_num, f->esp, sizeof syscall_num);
   switch (syscall_num) {
     case SYS_HALT:
       shutdown_power_off ();
@@ -156,8 +153,6 @@ sys_exit (int status)
     sys_close (fd->fd);
   }
 
-  file_allow_write (t->executable);
-
   struct shared_info *shared_info = t->shared_info;
   if (shared_info)
   {
@@ -166,17 +161,20 @@ sys_exit (int status)
     sema_up (&shared_info->exited);
   }
 
-  // use hash_clear to destroy each frame
+  // release each page's frame and swap slot
   struct hash_iterator it;
   hash_first (&it, &thread_current ()->page_table);
   while (hash_next (&it))
   {
     struct page_table_entry *pte = hash_entry (hash_cur (&it),
       struct page_table_entry, hash_elem);
-    if (pte->fte)
-      page_evict (pte);
+    page_free (pte);
   }
 
+  /* Only once our frames are gone, so that a shared executable page
+     left in the page cache cannot go stale under a write. */
+  file_allow_write (t->executable);
+
   thread_exit ();
 }
 
@@ -184,8 +182,9 @@ sys_exit (int status)
 static int
 sys_exec (const char *cmdline)
 {
-  validate_addr (cmdline);
-  int pid = process_execute (cmdline);
+  char *kcmdline = copy_in_string (cmdline);
+  int pid = process_execute (kcmdline);
+  palloc_free_page (kcmdline);
   return pid;
 }
 
@@ -193,11 +192,9 @@ sys_exec (const char *cmdline)
 static bool
 sys_create (const char *file_name, unsigned size)
 {
-  validate_addr (file_name);
-  bool success = false;
-  filesys_acquire ();
-  success = filesys_create (file_name, size);
-  filesys_release ();
+  char *kfile_name = copy_in_string (file_name);
+  bool success = filesys_create (kfile_name, size);
+  palloc_free_page (kfile_name);
   return success;
 }
 
@@ -205,10 +202,9 @@ sys_create (const char *file_name, unsigned size)
 static bool
 sys_remove (const char *file_name)
 {
-  validate_addr (file_name);
-  filesys_acquire ();
-  bool success = filesys_remove (file_name);
-  filesys_release ();
+  char *kfile_name = copy_in_string (file_name);
+  bool success = filesys_remove (kfile_name);
+  palloc_free_page (kfile_name);
   return success;
 }
 
@@ -216,11 +212,10 @@ sys_remove (const char *file_name)
 static int
 sys_open (const char *file_name)
 {
-  validate_addr (file_name);
+  char *kfile_name = copy_in_string (file_name);
+  struct file *file = filesys_open (kfile_name);
+  palloc_free_page (kfile_name);
 
-  filesys_acquire ();
-  struct file *file = filesys_open (file_name);
-  filesys_release ();
   struct list *fds = &thread_current ()->fds;
   struct fd *fd = malloc (sizeof *fd);
   
@@ -268,10 +263,10 @@ static int sys_read (int fd, void *buffer, unsigned size)
   int bytes_to_read = size;
   while (bytes_to_read > 0)
   {
-    struct page_table_entry *pte = page_load (vaddr);
-    if (!pte || !pte->writable)
+    /* Pinned, so that the copy below never faults in the kernel. */
+    struct page_table_entry *pte = page_pin (vaddr, true);
+    if (!pte)
       sys_exit (-1); // buffer is in invalid or read-only memory
-    validate_addr (vaddr);
 
     int bytes_left_in_page = PGSIZE - pg_ofs (vaddr);
     int bytes_read_to_page = bytes_to_read < bytes_left_in_page
@@ -286,6 +281,7 @@ static int sys_read (int fd, void *buffer, unsigned size)
     }
     else
       file_read (file, vaddr, bytes_read_to_page);
+    page_unpin (pte);
 
     vaddr += bytes_read_to_page;
     bytes_to_read -= bytes_read_to_page;
@@ -312,10 +308,10 @@ sys_write (int fd, const void *buffer, unsigned size)
   int bytes_to_write = size;
   while (bytes_to_write > 0)
   {
-    struct page_table_entry *pte = page_load (vaddr);
+    /* Pinned, so that the copy below never faults in the kernel. */
+    struct page_table_entry *pte = page_pin (vaddr, false);
     if (!pte)
-      sys_exit (-1); // buffer is in invalid or read-only memory
-    validate_addr (vaddr);
+      sys_exit (-1); // buffer is in invalid memory
 
     int bytes_left_in_page = PGSIZE - pg_ofs (vaddr);
     int bytes_written_from_page = bytes_to_write < bytes_left_in_page
@@ -326,9 +322,12 @@ sys_write (int fd, const void *buffer, unsigned size)
       putbuf (vaddr, bytes_written_from_page);
     }
     else {
-      if (file_write (file, vaddr, bytes_written_from_page) == 0)
+      if (file_write (file, vaddr, bytes_written_from_page) == 0) {
+        page_unpin (pte);
         return 0;
+      }
     }
+    page_unpin (pte);
  
     vaddr += bytes_written_from_page;
     bytes_to_write -= bytes_written_from_page;
@@ -392,45 +391,35 @@ sys_mmap (int fd, void *addr)
   struct file *file = fetch_file (fd);
   if (!file)
     return MAP_FAILED;
-  file = file_reopen (file);
-  uint32_t read_bytes = file_length (file);
-  if (read_bytes <= 0)
+  off_t length = file_length (file);
+  if (length <= 0)
+    return MAP_FAILED;
+  size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* The pages must be free.  Their page table entries are only
+     created when they are touched. */
+  uint8_t *upage = addr;
+  if (!is_user_vaddr (upage + page_cnt * PGSIZE - 1))
+    return MAP_FAILED;
+  for (size_t i = 0; i < page_cnt; i++)
+    if (page_find (upage + i * PGSIZE))
+      return MAP_FAILED;
+  if (page_find_mapping (upage, page_cnt * PGSIZE))
     return MAP_FAILED;
-  bool writable = file_writable (file);
 
   /* Set up bookkeeping for mapped memory. */
   struct list *mappings = &thread_current ()->mappings;
   struct mapping *mapping = malloc (sizeof *mapping);
+  if (!mapping)
+    return MAP_FAILED;
   mapping->mapid = list_empty (mappings) ? 0 
     : list_entry (list_back (mappings), struct mapping, elem)->mapid + 1;
-  mapping->file = file;
-  list_init (&mapping->mapped_pages);
-  list_push_back (&thread_current ()->mappings, &mapping->elem);
-
-  uint8_t *upage = addr;
-  off_t ofs = 0;
-  while (read_bytes > 0) 
-    {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-
-      struct page_table_entry *pte = page_alloc (upage, writable);
-      if (!pte)
-        return MAP_FAILED;
-
-      /* Populate page table entry. */
-      pte->file = file;
-      pte->file_ofs = ofs;
-      pte->file_bytes = page_read_bytes;
-      pte->mapped = true;
-      list_push_back (&mapping->mapped_pages, &pte->list_elem);
-
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      upage += PGSIZE;
-      ofs += PGSIZE;
-    }
+  mapping->file = file_reopen (file);
+  mapping->base = upage;
+  mapping->page_cnt = page_cnt;
+  mapping->length = length;
+  mapping->writable = file_writable (mapping->file);
+  list_push_back (mappings, &mapping->elem);
 
   return mapping->mapid;
 }
@@ -460,12 +449,7 @@ sys_munmap (mapid_t mapid)
 static void
 fetch_args (struct intr_frame *f, int *argv, int num)
 {
-  for (int i = 1; i <= num; i++)
-  {
-    int *arg = (int *) f->esp + i;
-    validate_addr ((const void *) arg);
-    argv[i - 1] = *arg;
-  }
+  copy_in (argv, (int *) f->esp + 1, num * sizeof *argv);
 }
 
 /* Fetches a file handle from the current thread given a file descriptor. */
@@ -487,32 +471,83 @@ fetch_file (int fd_to_find)
   return NULL;
 }
 
-/* Check if an address is valid using the methods described on the project page. */
+/* Copies SIZE bytes from user address USRC to DST.  Each page of
+   USRC is pinned while it is read, so that the copy never faults in
+   the kernel.  Exits the process if any of it is not mapped. */
 static void
-validate_addr (const void *addr)
+copy_in (void *dst_, const void *usrc_, size_t size)
 {
-  char *ptr = (char*)(addr); // increment through the address one byte at a time
-  for (unsigned i = 0; i < sizeof (addr); i++)
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  while (size > 0)
   {
-    if (!is_user_vaddr (ptr) || !pagedir_get_page (thread_current()->pagedir, ptr))
+    size_t chunk = PGSIZE - pg_ofs (usrc);
+    if (chunk > size)
+      chunk = size;
+
+    struct page_table_entry *pte = page_pin (usrc, false);
+    if (!pte)
       sys_exit (-1); // -1 for memory violations
-    ++ptr;
+    memcpy (dst, usrc, chunk);
+    page_unpin (pte);
+
+    dst += chunk;
+    usrc += chunk;
+    size -= chunk;
+  }
+}
+
+/* Copies the string at user address US into a new page, which the
+   caller must free with palloc_free_page (), and returns it.  Like
+   process_execute (), truncates it to PGSIZE - 1 characters.  Exits
+   the process if the string is not mapped or no page is free. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks = palloc_get_page (0);
+  if (!ks)
+    sys_exit (-1);
+
+  size_t len = 0;
+  for (;;)
+  {
+    size_t chunk = PGSIZE - pg_ofs (us + len);
+    if (chunk > PGSIZE - 1 - len)
+      chunk = PGSIZE - 1 - len;
+
+    struct page_table_entry *pte = page_pin (us + len, false);
+    if (!pte)
+    {
+      palloc_free_page (ks);
+      sys_exit (-1); // -1 for memory violations
+    }
+    size_t i;
+    for (i = 0; i < chunk && us[len + i] != '\0'; i++)
+      ks[len + i] = us[len + i];
+    page_unpin (pte);
+
+    len += i;
+    if (i < chunk || len == PGSIZE - 1)
+    {
+      ks[len] = '\0';
+      return ks;
+    }
   }
 }
 
 static void
 free_mapping (struct mapping *mapping)
 {
-  struct list *mapped_pages = &mapping->mapped_pages;
-
-  while (!list_empty (mapped_pages)) {
-    struct page_table_entry *pte = list_entry (list_pop_front (mapped_pages),
-                                               struct page_table_entry,
-                                               list_elem);
-      page_evict (pte); // write to swap, remove from pd, uninstall the frame
-      hash_delete (&thread_current ()->page_table, &pte->hash_elem);
-      free (pte); // delete supplemental pte
+  for (size_t i = 0; i < mapping->page_cnt; i++) {
+    struct page_table_entry *pte = page_find (mapping->base + i * PGSIZE);
+    if (!pte)
+      continue; // never touched
+    page_evict (pte); // write to file, remove from pd, uninstall the frame
+    hash_delete (&thread_current ()->page_table, &pte->hash_elem);
+    free (pte); // delete supplemental pte
   }
 
+  list_remove (&mapping->elem);
   free (mapping);
 }
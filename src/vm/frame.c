@@ -1,129 +1,429 @@
-#include "threads/malloc.h"
+#include <round.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 
-/* Frame table initialization. */
+/* Frame table.  One entry per page of the user pool, indexed by
+   the page's position in the pool, so that looking up the entry
+   for a kpage is pointer arithmetic rather than a search. */
+static struct frame_table_entry *frame_table;
+static size_t frame_cnt;          /* Number of entries in frame_table. */
+static uint8_t *frame_base;       /* Kernel address of first user frame. */
+static struct lock frame_table_lock;
+
+/* A frame of zeros, mapped read-only by every anonymous page that
+   has been read but never written.  It comes from the kernel pool,
+   so it has no frame table entry and is never evicted. */
+static void *zero_kpage;
+
+/* Page cache of shared read-only file pages, by inode and offset.
+   Protected by frame_table_lock. */
+static struct hash page_cache;
+static hash_hash_func page_cache_hash;
+static hash_less_func page_cache_less;
+
+/* Free frame count and page-out daemon watermarks.  The daemon
+   wakes when free frames drop below LOW_WATERMARK and evicts
+   until there are at least HIGH_WATERMARK of them. */
+static size_t free_cnt;
+static size_t low_watermark;
+static size_t high_watermark;
+static struct condition pageout_cond; /* Signaled below LOW_WATERMARK. */
+
+static thread_func pageout_daemon NO_RETURN;
+static struct frame_table_entry *frame_claim (void *kpage,
+                                              struct page_table_entry *pte);
+static void frame_rmap_add (struct frame_table_entry *fte,
+                            struct page_table_entry *pte);
+
+/* Clock hands for frame_victim (), as indexes into frame_table. */
+static size_t front_hand;
+static size_t back_hand;
+
+/* The clock hands are frame_cnt / HAND_SPREAD frames apart. */
+#define HAND_SPREAD (4)
+
+/* Frame table initialization.
+   Must be called after palloc_init (), since the table is sized
+   once from the user pool.  LOW and HIGH are the page-out
+   daemon's watermarks, in frames, or SIZE_MAX to size them from
+   the user pool. */
 void
-frame_table_init (void)
+frame_table_init (size_t low, size_t high)
 {
-  hash_init (&frame_table, frame_hash, frame_less, NULL);
+  frame_base = palloc_user_pool (&frame_cnt);
+  size_t pages = DIV_ROUND_UP (frame_cnt * sizeof *frame_table, PGSIZE);
+  frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, pages);
   lock_init (&frame_table_lock);
+  zero_kpage = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+  for (size_t i = 0; i < frame_cnt; i++) {
+    struct frame_table_entry *fte = &frame_table[i];
+    fte->kpage = frame_base + i * PGSIZE;
+    fte->pte = NULL;
+    fte->inode = NULL;
+    list_init (&fte->rmaps);
+    fte->ref_cnt = 0;
+    fte->pin_cnt = 0;
+    lock_init (&fte->lock);
+  }
+  hash_init (&page_cache, page_cache_hash, page_cache_less, NULL);
+  back_hand = 0;
+  front_hand = frame_cnt / HAND_SPREAD;
+
+  free_cnt = frame_cnt;
+  low_watermark = low != SIZE_MAX ? low : frame_cnt / 32;
+  high_watermark = high != SIZE_MAX ? high : low_watermark * 2;
+  if (high_watermark > frame_cnt / 2)
+    high_watermark = frame_cnt / 2;
+  if (low_watermark > high_watermark)
+    low_watermark = high_watermark;
+  cond_init (&pageout_cond);
 }
 
-/* Returns a hash value for frame f. */
-unsigned
-frame_hash (const struct hash_elem *f_, void *aux UNUSED)
+/* Starts the page-out daemon.  Must be called once swap is
+   available. */
+void
+frame_pageout_start (void)
 {
-  const struct frame_table_entry *f = hash_entry (f_, struct frame_table_entry,
-                                                  hash_elem);
-  return hash_bytes (&f->kpage, sizeof f->kpage);
+  if (high_watermark > 0)
+    thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL);
 }
 
-/* Returns true if frame a precedes frame b. */
-bool
-frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
-           void *aux UNUSED)
+/* Page-out daemon.  Sleeps until free frames drop below the low
+   watermark, then evicts pages in a batch until the high
+   watermark is reached, so that page faults can usually be
+   served from a free frame without waiting for swap I/O. */
+static void
+pageout_daemon (void *aux UNUSED)
 {
-  const struct frame_table_entry *a = hash_entry (a_, struct frame_table_entry,
-                                                  hash_elem);
-  const struct frame_table_entry *b = hash_entry (b_, struct frame_table_entry,
-                                                  hash_elem);
-  return a->kpage < b->kpage;
+  for (;;) {
+    lock_acquire (&frame_table_lock);
+    while (free_cnt >= low_watermark)
+      cond_wait (&pageout_cond, &frame_table_lock);
+    lock_release (&frame_table_lock);
+
+    while (free_cnt < high_watermark)
+      page_evict (NULL);
+  }
+}
+
+/* Returns the frame table entry for user frame KPAGE. */
+struct frame_table_entry *
+frame_lookup (const void *kpage)
+{
+  ASSERT (pg_ofs (kpage) == 0);
+  ASSERT ((uint8_t *) kpage >= frame_base);
+  ASSERT (pg_no (kpage) - pg_no (frame_base) < frame_cnt);
+  return &frame_table[pg_no (kpage) - pg_no (frame_base)];
 }
 
-/* Allocates a frame for the given page. */
+/* Returns the shared zero frame.  It must only be mapped
+   read-only. */
+void *
+frame_zero (void)
+{
+  return zero_kpage;
+}
+
+/* Allocates a frame for the given page and returns it with its
+   lock held.  The frame's contents are undefined; the caller
+   fills all of it. */
 struct frame_table_entry*
 frame_alloc (struct page_table_entry *pte)
 {
-  void *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (!kpage) {
+  /* Normally the page-out daemon keeps frames free.  If it has
+     fallen behind, evict synchronously, retrying in case another
+     thread takes the frame we freed. */
+  void *kpage;
+  while (!(kpage = palloc_get_page (PAL_USER)))
     page_evict (NULL);
-    kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-    if (!kpage)
-      PANIC ("PAGE EVICTION FAILED");
+  return frame_claim (kpage, pte);
+}
+
+/* Allocates a frame for the given page, as frame_alloc (), but
+   only if that needs neither eviction nor dipping below the
+   page-out daemon's low watermark.  Returns NULL otherwise.
+   Meant for speculative allocations such as read-ahead. */
+struct frame_table_entry *
+frame_try_alloc (struct page_table_entry *pte)
+{
+  if (free_cnt <= low_watermark)
+    return NULL;
+  void *kpage = palloc_get_page (PAL_USER);
+  if (!kpage)
+    return NULL;
+  return frame_claim (kpage, pte);
+}
+
+/* Records freshly allocated user frame KPAGE as holding PTE and
+   returns its entry with the lock held. */
+static struct frame_table_entry *
+frame_claim (void *kpage, struct page_table_entry *pte)
+{
+  struct frame_table_entry *fte = frame_lookup (kpage);
+  frame_acquire (fte);
+
+  lock_acquire (&frame_table_lock);
+  frame_rmap_add (fte, pte);
+  if (--free_cnt < low_watermark)
+    cond_signal (&pageout_cond, &frame_table_lock);
+  lock_release (&frame_table_lock);
+  return fte;
+}
+
+/* Frees FTE, whose lock must be held by the caller.
+   Releases the lock, since frame table entries are never
+   destroyed. */
+void
+frame_free (struct frame_table_entry *fte)
+{
+  ASSERT (lock_held_by_current_thread (&fte->lock));
+  lock_acquire (&frame_table_lock);
+
+  if (fte->inode) {
+    hash_delete (&page_cache, &fte->hash_elem);
+    fte->inode = NULL;
   }
-  struct frame_table_entry *fte = malloc (sizeof *fte);
+  ASSERT (list_empty (&fte->rmaps));
+  ASSERT (fte->pin_cnt == 0);
+  fte->pte = NULL;
+  palloc_free_page (fte->kpage);
+  free_cnt++;
+
+  lock_release (&frame_table_lock);
+  lock_release (&fte->lock);
+}
+
+/* Looks up the page cache for a frame that already holds the file
+   page PTE describes.  If there is one, maps it into PTE's
+   address space read-only, adds PTE to its mappers, and returns
+   it with its lock held.  Returns NULL otherwise. */
+struct frame_table_entry *
+frame_share_get (struct page_table_entry *pte)
+{
+  struct frame_table_entry key;
+  key.inode = file_get_inode (pte->file);
+  key.ofs = pte->file_ofs;
+
+  lock_acquire (&frame_table_lock);
+  struct hash_elem *e = hash_find (&page_cache, &key.hash_elem);
+  struct frame_table_entry *fte = e ? hash_entry (e, struct frame_table_entry,
+                                                  hash_elem) : NULL;
+  lock_release (&frame_table_lock);
   if (!fte)
     return NULL;
-  fte->kpage = kpage; // store frame kpage
-  fte->thread = thread_current (); // store frame thread
-  fte->pte = pte; // store frame pte
-  lock_init (&fte->lock);
 
+  /* The frame lock ranks above the frame table lock, so take it
+     now and check that the frame still holds the page. */
+  frame_acquire (fte);
   lock_acquire (&frame_table_lock);
-  if (hash_insert (&frame_table, &fte->hash_elem)) {
-    free (fte);
-    pte->fte = NULL;
-    palloc_free_page (kpage);
-    lock_release (&frame_table_lock);
+  bool valid = fte->inode == key.inode && fte->ofs == key.ofs
+               && fte->pte->file_bytes == pte->file_bytes;
+  if (valid)
+    frame_rmap_add (fte, pte);
+  lock_release (&frame_table_lock);
+
+  if (!valid) {
+    frame_release (fte);
     return NULL;
   }
-  lock_release (&frame_table_lock);
   return fte;
 }
 
+/* Enters FTE, whose lock must be held and which holds a freshly
+   read read-only file page, into the page cache so that other
+   processes can share it.  If another frame got there first, FTE
+   stays private. */
 void
-frame_free (struct frame_table_entry *fte)
+frame_share_add (struct frame_table_entry *fte)
 {
   ASSERT (lock_held_by_current_thread (&fte->lock));
+  ASSERT (fte->inode == NULL);
+
   lock_acquire (&frame_table_lock);
+  fte->inode = file_get_inode (fte->pte->file);
+  fte->ofs = fte->pte->file_ofs;
+  if (hash_insert (&page_cache, &fte->hash_elem))
+    fte->inode = NULL;
+  lock_release (&frame_table_lock);
+}
 
-  hash_delete (&frame_table, &fte->hash_elem);
-  palloc_free_page (fte->kpage);
-  free (fte);
+/* Adds PTE, which is about to map FTE into its owner's address
+   space, to FTE's reverse map.  The frame table lock must be
+   held. */
+static void
+frame_rmap_add (struct frame_table_entry *fte, struct page_table_entry *pte)
+{
+  ASSERT (lock_held_by_current_thread (&frame_table_lock));
+
+  pte->rmap.pagedir = pte->thread->pagedir;
+  pte->rmap.upage = pte->upage;
+  list_push_back (&fte->rmaps, &pte->rmap.elem);
+  fte->ref_cnt++;
+  if (!fte->pte)
+    fte->pte = pte;
+}
+
+/* Returns the page table entry of mapping E of a frame. */
+static struct page_table_entry *
+rmap_pte (struct list_elem *e)
+{
+  return list_entry (e, struct page_table_entry, rmap.elem);
+}
 
+/* Unmaps FTE, whose lock must be held, from PTE's address space
+   and removes PTE from its reverse map.  Returns true if other
+   mappings remain, in which case the frame stays allocated, or
+   false if PTE was the last one and the caller should free the
+   frame. */
+bool
+frame_unmap (struct frame_table_entry *fte, struct page_table_entry *pte)
+{
+  ASSERT (lock_held_by_current_thread (&fte->lock));
+
+  lock_acquire (&frame_table_lock);
+  pagedir_clear_page (pte->rmap.pagedir, pte->rmap.upage);
+  list_remove (&pte->rmap.elem);
+  fte->ref_cnt--;
+  if (fte->pte == pte && fte->ref_cnt > 0)
+    fte->pte = rmap_pte (list_front (&fte->rmaps));
+  bool mapped = fte->ref_cnt > 0;
   lock_release (&frame_table_lock);
-  // no need to release destroyed fte's lock
+  return mapped;
 }
 
-/* Find a frame to evict from the frame table. 
-    Uses a two-handed clock algorithm.
-    The hands of the clock are placed randomly somewhere in the frame table.
-    Distance between two hands is total # of frames / HAND_SPREAD pages.*/
-#define HAND_SPREAD (4)
-struct page_table_entry *
-frame_victim (void)
+/* Unmaps FTE, whose lock must be held, from every address space
+   that maps it, for eviction.  Mappers other than FTE->pte lose
+   the frame here; FTE->pte keeps it until the caller frees it.
+   Returns true if any mapping dirtied the page. */
+bool
+frame_unmap_all (struct frame_table_entry *fte)
 {
+  ASSERT (lock_held_by_current_thread (&fte->lock));
+  bool dirty = false;
+
   lock_acquire (&frame_table_lock);
+  while (!list_empty (&fte->rmaps)) {
+    struct page_table_entry *pte = rmap_pte (list_pop_front (&fte->rmaps));
+    pagedir_clear_page (pte->rmap.pagedir, pte->rmap.upage);
+    if (pte->dirty || pagedir_is_dirty (pte->rmap.pagedir, pte->rmap.upage))
+      dirty = true;
+    if (pte != fte->pte)
+      pte->fte = NULL;
+    fte->ref_cnt--;
+  }
+  lock_release (&frame_table_lock);
+  return dirty;
+}
 
-  /* Dirty runtime initialization of frame_table_size. */
-  static int frame_table_size = -1;
-  if (frame_table_size == -1)
-    frame_table_size = hash_size (&frame_table);
-
-  struct hash_iterator it;
-  hash_first (&it, &frame_table);
-  struct frame_table_entry *fte_2 = hash_entry (hash_next (&it),
-                                                struct frame_table_entry,
-                                                hash_elem);
-  for (int i = 0; i < frame_table_size / HAND_SPREAD; i++)
-    hash_next (&it);
-  struct frame_table_entry *fte_1 = hash_entry (hash_cur (&it),
-                                                struct frame_table_entry,
-                                                hash_elem);
-  if (!fte_1 || !fte_2)
-    PANIC ("FRAME EVICTION FAILURE");
-
-  /* FRAME_TABLE_SIZE should be equal to total # of frames. */
-  /* FTE_1 should be (FRAME_TABLE_SIZE / HAND_SPREAD) pages in front of 
-      FTE_2. */
-
-  struct frame_table_entry *fte_victim = NULL;
-  while (!fte_victim) {
-    if (fte_1->pte->accessed)
-      fte_1->pte->accessed = false;
-    if (!fte_2->pte->accessed)
-      fte_victim = fte_2;
-    if (!hash_next (&it))
-      hash_first (&it, &frame_table);
-
-    fte_2 = fte_1;
-    fte_1 = hash_entry (hash_cur (&it), struct frame_table_entry, hash_elem);
+/* Returns true if FTE's page is dirty, that is, if evicting it
+   would require writing it out. */
+static bool
+frame_is_dirty (struct frame_table_entry *fte)
+{
+  struct list_elem *e;
+  for (e = list_begin (&fte->rmaps); e != list_end (&fte->rmaps);
+       e = list_next (e)) {
+    struct page_table_entry *pte = rmap_pte (e);
+    if (pte->dirty || pagedir_is_dirty (pte->rmap.pagedir, pte->rmap.upage))
+      return true;
+  }
+  return false;
+}
+
+/* Returns true if FTE's page has been accessed, through any of its
+   mappings, since its accessed bits were last cleared. */
+static bool
+frame_is_accessed (struct frame_table_entry *fte)
+{
+  struct list_elem *e;
+  for (e = list_begin (&fte->rmaps); e != list_end (&fte->rmaps);
+       e = list_next (e)) {
+    struct page_table_entry *pte = rmap_pte (e);
+    if (pte->accessed
+        || pagedir_is_accessed (pte->rmap.pagedir, pte->rmap.upage))
+      return true;
+  }
+  return false;
+}
+
+/* Clears both the software and the hardware accessed bits of
+   FTE's page, for all of its mappings. */
+static void
+frame_clear_accessed (struct frame_table_entry *fte)
+{
+  struct list_elem *e;
+  for (e = list_begin (&fte->rmaps); e != list_end (&fte->rmaps);
+       e = list_next (e)) {
+    struct page_table_entry *pte = rmap_pte (e);
+    pte->accessed = false;
+    pagedir_set_accessed (pte->rmap.pagedir, pte->rmap.upage, false);
   }
+}
+
+/* Find a frame to evict from the frame table and return it with
+    its lock held.
+    Uses a two-handed clock algorithm.  The front hand clears
+    accessed bits, and the back hand, total # of frames /
+    HAND_SPREAD frames behind it, picks frames whose accessed bit
+    is still clear.  The hands persist across calls.
+    Clean frames are preferred over dirty ones: a dirty candidate is
+    only taken if the back hand sweeps a full revolution without
+    finding a clean one. */
+struct frame_table_entry *
+frame_victim (void)
+{
+  struct frame_table_entry *victim = NULL;
+  struct frame_table_entry *dirty_victim = NULL;
+  size_t step = 0;
+
+  lock_acquire (&frame_table_lock);
+  while (!victim) {
+    struct frame_table_entry *front = &frame_table[front_hand];
+    struct frame_table_entry *back = &frame_table[back_hand];
+    front_hand = (front_hand + 1) % frame_cnt;
+    back_hand = (back_hand + 1) % frame_cnt;
+    step++;
+
+    if (front->pte)
+      frame_clear_accessed (front);
 
+    /* Skip free frames, recently used frames, frames that are
+       being loaded or evicted by another thread, and pinned frames. */
+    if (back->pte && !frame_is_accessed (back)
+        && lock_try_acquire (&back->lock)) {
+      if (back->pin_cnt > 0)
+        lock_release (&back->lock);
+      else if (!frame_is_dirty (back))
+        victim = back;
+      else if (!dirty_victim)
+        dirty_victim = back;
+      else
+        lock_release (&back->lock);
+    }
+
+    if (!victim && step >= frame_cnt) {
+      if (dirty_victim) {
+        victim = dirty_victim;
+        dirty_victim = NULL;
+      } else if (step >= 2 * frame_cnt) {
+        /* Every frame is busy.  Let their owners make progress. */
+        lock_release (&frame_table_lock);
+        thread_yield ();
+        lock_acquire (&frame_table_lock);
+        step = 0;
+      }
+    }
+  }
+  if (dirty_victim)
+    lock_release (&dirty_victim->lock);
   lock_release (&frame_table_lock);
 
-  return fte_victim->pte;
+  return victim;
 }
 
 /* Acquire frame lock. */
@@ -139,3 +439,26 @@ frame_release (struct frame_table_entry *fte)
 {
   lock_release (&fte->lock);
 }
+
+/* Page cache hash function. */
+static unsigned
+page_cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame_table_entry *fte;
+  fte = hash_entry (e, struct frame_table_entry, hash_elem);
+  return hash_bytes (&fte->inode, sizeof fte->inode) ^ hash_int (fte->ofs);
+}
+
+/* Page cache comparison function. */
+static bool
+page_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct frame_table_entry *a = hash_entry (a_, struct frame_table_entry,
+                                                  hash_elem);
+  const struct frame_table_entry *b = hash_entry (b_, struct frame_table_entry,
+                                                  hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->ofs < b->ofs;
+}
@@ -2,32 +2,49 @@
 #define FRAME_H
 
 #include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "vm/page.h"
 
-struct hash frame_table;
-struct lock frame_table_lock;
-
-struct frame_table_entry 
+struct frame_table_entry
 {
   void *kpage;                    /* Frame. */
-  struct thread *thread;          /* Owner thread of the frame. */
-  struct page_table_entry *pte;   /* Page table entry. */
-
-  struct hash_elem hash_elem;     /* Element for frame table. */
+  struct page_table_entry *pte;   /* Page held, which is its first mapper,
+                                     or NULL if free. */
+
+  /* Reverse map: every mapping of the frame, as the struct rmap of
+     each mapper's page table entry.  Read-only file pages are shared
+     by every process that maps the same INODE and OFS.  Changes to
+     these fields hold both the frame's lock and the frame table
+     lock. */
+  struct list rmaps;              /* List of struct rmap. */
+  size_t ref_cnt;                 /* Number of mappings. */
+  struct inode *inode;            /* Page cache key, or NULL. */
+  off_t ofs;                      /* Page cache key. */
+  struct hash_elem hash_elem;     /* Page cache element. */
+
+  size_t pin_cnt;                 /* Pins held; a pinned frame is never
+                                     evicted.  Protected by LOCK. */
   struct lock lock;               /* Lock. */
 };
 
-void frame_table_init (void);
-unsigned frame_hash (const struct hash_elem *f_, void *aux);
-bool frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
-                 void *aux);
+void frame_table_init (size_t low, size_t high);
+void frame_pageout_start (void);
+struct frame_table_entry *frame_lookup (const void *kpage);
+void *frame_zero (void);
 
 struct frame_table_entry *frame_alloc (struct page_table_entry *pte);
+struct frame_table_entry *frame_try_alloc (struct page_table_entry *pte);
 void frame_free (struct frame_table_entry *fte);
-struct page_table_entry *frame_victim (void);
+struct frame_table_entry *frame_share_get (struct page_table_entry *pte);
+void frame_share_add (struct frame_table_entry *fte);
+bool frame_unmap (struct frame_table_entry *fte,
+                  struct page_table_entry *pte);
+bool frame_unmap_all (struct frame_table_entry *fte);
+struct frame_table_entry *frame_victim (void);
 
 void frame_acquire (struct frame_table_entry *fte);
 void frame_release (struct frame_table_entry *fte);
@@ -1,3 +1,4 @@
+#include <round.h>
 #include <string.h>
 #include "filesys/file.h"
 #include "threads/malloc.h"
@@ -13,9 +14,32 @@
 /* Max user stack size. 8MB. */
 #define USER_STACK (8 * 1024 * 1024)
 
+/* Limits of the swap read-ahead window, in pages. */
+#define RA_MIN (1)
+#define RA_MAX (16)
+
+/* Sectors in one page's swap slot. */
+#define SWAP_PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A fault on a file page also maps the other pages of the aligned
+   block of FAULT_AROUND pages around it. */
+#define FAULT_AROUND (8)
+
 static void page_init (struct page_table_entry *pte);
 static bool page_read (struct page_table_entry *pte);
 static void page_write (struct page_table_entry *pte);
+static struct frame_table_entry *page_map (struct page_table_entry *pte,
+                                           bool speculative);
+static void page_readahead (const void *upage);
+static size_t page_gather_swapped (uint8_t *upage, size_t max,
+                                   struct page_table_entry *ptes[]);
+static size_t page_map_swapped (struct page_table_entry *ptes[],
+                                size_t cnt);
+static void page_fault_around (const void *upage);
+static struct page_table_entry *page_alloc_mapped (struct mapping *mapping,
+                                                   void *upage);
+static bool page_is_fresh (const struct page_table_entry *pte);
+static bool page_is_shareable (const struct page_table_entry *pte);
 
 /* NOTE The following two functions (page_hash and page_less) were taken from
 the class project guide! Specifically from A.8.5 Hash Table Examples. */
@@ -41,9 +65,12 @@ page_less (const struct hash_elem *a_, const struct hash_elem *b_,
 }
 
 /* Given an address, load the page into memory and return success,
-otherwise return a load failure and kill thread. */
+otherwise return a load failure and kill thread.  WRITE is true if
+the page is about to be written.  An anonymous page that has never
+been written is only given a frame of its own on a write; reads map
+the shared zero frame. */
 struct page_table_entry *
-page_load (const void *fault_addr)
+page_load (const void *fault_addr, bool write)
 {
   if (!fault_addr)
     return NULL;
@@ -52,39 +79,262 @@ page_load (const void *fault_addr)
   struct page_table_entry *pte = page_get (fault_addr, true);
   if (!pte)
     return NULL;
+  if (write && !pte->writable)
+    return NULL;
 
   if (pte->fte)
     return pte; // page is already installed
 
-  /* Allocate a frame. */
-  struct frame_table_entry *fte = frame_alloc (pte);
-  if (!fte) {
+  if (pte->zero) {
+    if (!write)
+      return pte;
+    /* First write: replace the zero frame with a private one. */
+    pagedir_clear_page (pte->thread->pagedir, pte->upage);
+    pte->zero = false;
+  } else if (!write && page_is_fresh (pte)) {
+    if (!install_page (pte->upage, frame_zero (), false))
+      return NULL;
+    pte->zero = true;
+    return pte;
+  }
+
+  bool swapped = pte->swapped;
+  struct frame_table_entry *fte = page_map (pte, false);
+  if (!fte)
     return NULL;
+  pte->accessed = true;
+  frame_release (fte);
+
+  if (swapped)
+    page_readahead (pte->upage);
+  else if (pte->file)
+    page_fault_around (pte->upage);
+  return pte;
+}
+
+/* Loads the page containing VADDR, as page_load () does, and pins
+   its frame so that it stays resident until page_unpin ().  For
+   system calls that copy to or from a user buffer, which must not
+   fault in the kernel.  A page that is only read and maps the zero
+   frame needs no pin.  Returns NULL if the page cannot be loaded. */
+struct page_table_entry *
+page_pin (const void *vaddr, bool write)
+{
+  for (;;) {
+    struct page_table_entry *pte = page_load (vaddr, write);
+    if (!pte)
+      return NULL;
+    if (pte->zero && !write)
+      return pte;
+
+    /* The frame may be evicted before we lock it; if so, retry. */
+    struct frame_table_entry *fte = pte->fte;
+    if (!fte)
+      continue;
+    frame_acquire (fte);
+    if (pte->fte == fte) {
+      fte->pin_cnt++;
+      frame_release (fte);
+      return pte;
+    }
+    frame_release (fte);
   }
+}
 
-  /* Load data into the page. */
-  pte->fte = fte;
+/* Releases a pin taken on PTE's frame by page_pin (). */
+void
+page_unpin (struct page_table_entry *pte)
+{
+  struct frame_table_entry *fte = pte->fte;
+  if (!fte)
+    return; // mapped to the zero frame
   frame_acquire (fte);
-  if (!page_read (pte)) {
-    frame_free (fte);
-    pte->fte = NULL;
-    return NULL;
+  ASSERT (fte->pin_cnt > 0);
+  fte->pin_cnt--;
+  frame_release (fte);
+}
+
+/* Gives PTE a frame holding its page and maps it.  The frame is
+   one already holding the page, if the page cache has one, or
+   else a new frame that the page is read into.  If SPECULATIVE,
+   a new frame is only taken if one is free without eviction.
+   Returns the frame with its lock held, or NULL on failure. */
+static struct frame_table_entry *
+page_map (struct page_table_entry *pte, bool speculative)
+{
+  struct frame_table_entry *fte;
+
+  /* Share the frame of a process that already has the page. */
+  if (page_is_shareable (pte) && (fte = frame_share_get (pte))) {
+    pte->fte = fte;
+    if (!install_page (pte->upage, fte->kpage, false)) {
+      pte->fte = NULL;
+      frame_unmap (fte, pte);
+      frame_release (fte);
+      return NULL;
+    }
+    return fte;
   }
 
-  /* Install the page into frame. */
-  if (!install_page (pte->upage, fte->kpage, pte->writable)) {
-    frame_free (fte);
+  /* Allocate a frame and load data into it. */
+  fte = speculative ? frame_try_alloc (pte) : frame_alloc (pte);
+  if (!fte)
+    return NULL;
+  pte->fte = fte;
+  if (!page_read (pte)
+      || !install_page (pte->upage, fte->kpage, pte->writable)) {
     pte->fte = NULL;
+    frame_unmap (fte, pte);
+    frame_free (fte);
     return NULL;
   }
-  frame_release (fte);
+  if (page_is_shareable (pte))
+    frame_share_add (fte);
+  return fte;
+}
 
-  pte->accessed = true;
-  return pte;
+/* Called after the file page UPAGE was faulted in.  Maps the other
+   file pages of the aligned FAULT_AROUND block around UPAGE too,
+   if they are in the page cache or a frame is free to read them
+   into, so that touching a run of code or of a mapped file takes
+   one fault instead of one per page.  Pages mapped this way are
+   not marked accessed, so unused ones are the first evicted. */
+static void
+page_fault_around (const void *upage)
+{
+  uint8_t *start = (uint8_t *) ROUND_DOWN ((uintptr_t) upage,
+                                           FAULT_AROUND * PGSIZE);
+  for (uint8_t *p = start; p < start + FAULT_AROUND * PGSIZE; p += PGSIZE) {
+    struct page_table_entry *pte = page_get (p, false);
+    if (!pte || !pte->file || pte->swapped || pte->fte || pte->zero)
+      continue;
+    struct frame_table_entry *fte = page_map (pte, true);
+    if (!fte)
+      break;
+    frame_release (fte);
+  }
+}
+
+/* Called after UPAGE was paged in from swap.  If the current
+   thread's swap faults look sequential, also pages in the swapped
+   out pages that follow UPAGE, as many as the read-ahead window
+   allows and free frames permit, so that a thread streaming
+   through a swapped out array does not fault on every page.
+   The window doubles while all read-ahead pages get used and
+   halves when most of them do not. */
+static void
+page_readahead (const void *upage)
+{
+  struct thread *t = thread_current ();
+  bool sequential = upage == t->ra_next;
+
+  /* Adapt the window to how much of the last read-ahead was used. */
+  if (t->ra_window == 0)
+    t->ra_window = RA_MIN;
+  if (t->ra_cnt > 0) {
+    size_t hits = 0;
+    for (size_t i = 0; i < t->ra_cnt; i++)
+      if (pagedir_is_accessed (t->pagedir, t->ra_start + i * PGSIZE))
+        hits++;
+    if (hits == t->ra_cnt && t->ra_window < RA_MAX)
+      t->ra_window *= 2;
+    else if (hits * 2 < t->ra_cnt && t->ra_window > RA_MIN)
+      t->ra_window /= 2;
+    t->ra_cnt = 0;
+  }
+
+  uint8_t *next = (uint8_t *) upage + PGSIZE;
+  t->ra_start = next;
+  if (sequential) {
+    while (t->ra_cnt < t->ra_window) {
+      /* Pages in consecutive slots on the swap device, which swap
+         clustering makes likely, are read with one request. */
+      struct page_table_entry *batch[RA_MAX];
+      size_t n = page_gather_swapped (next, t->ra_window - t->ra_cnt,
+                                      batch);
+      if (n > 0) {
+        size_t mapped = page_map_swapped (batch, n);
+        t->ra_cnt += mapped;
+        next += mapped * PGSIZE;
+        if (mapped < n)
+          break;
+        continue;
+      }
+
+      /* Otherwise, a page in the compressed pool. */
+      struct page_table_entry *pte = page_get (next, false);
+      if (!pte || !pte->swapped || pte->fte)
+        break;
+      struct frame_table_entry *fte = page_map (pte, true);
+      if (!fte)
+        break;
+      frame_release (fte);
+      t->ra_cnt++;
+      next += PGSIZE;
+    }
+  }
+  t->ra_next = next;
+}
+
+/* Stores into PTES the swapped out pages starting at UPAGE, up to
+   MAX of them, that are on the swap device in consecutive slots,
+   and returns how many there are. */
+static size_t
+page_gather_swapped (uint8_t *upage, size_t max,
+                     struct page_table_entry *ptes[])
+{
+  size_t n;
+
+  for (n = 0; n < max; n++) {
+    struct page_table_entry *pte = page_get (upage + n * PGSIZE, false);
+    if (!pte || !pte->swapped || pte->fte || pte->zslot != -1)
+      break;
+    if (n > 0 && pte->sector != ptes[n - 1]->sector + SWAP_PAGE_SECTORS)
+      break;
+    ptes[n] = pte;
+  }
+  return n;
+}
+
+/* Gives each of the CNT pages in PTES, gathered by
+   page_gather_swapped (), a free frame, reads them all in with one
+   request, and maps them, as page_map (PTE, true) does one at a
+   time.  Returns the number mapped, which is less than CNT if free
+   frames run out. */
+static size_t
+page_map_swapped (struct page_table_entry *ptes[], size_t cnt)
+{
+  struct frame_table_entry *ftes[RA_MAX];
+  size_t n, i;
+
+  ASSERT (cnt <= RA_MAX);
+  for (n = 0; n < cnt; n++) {
+    ftes[n] = frame_try_alloc (ptes[n]);
+    if (!ftes[n])
+      break;
+    ptes[n]->fte = ftes[n];
+    ptes[n]->dirty = false;
+  }
+  if (n == 0)
+    return 0;
+
+  swap_read_multiple (ftes, n);
+  for (i = 0; i < n; i++) {
+    if (!install_page (ptes[i]->upage, ftes[i]->kpage, ptes[i]->writable)) {
+      /* The page's slot still holds it. */
+      ptes[i]->fte = NULL;
+      ptes[i]->swapped = true;
+      frame_unmap (ftes[i], ptes[i]);
+      frame_free (ftes[i]);
+    } else
+      frame_release (ftes[i]);
+  }
+  return n;
 }
 
 /* Given an address, get the page associated with it or return NULL.
-Allocates new pages as necessary, if stack is true. */
+Allocates new pages as necessary: for memory-mapped files, and for
+the stack if stack is true. */
 struct page_table_entry *
 page_get (const void *vaddr, bool stack)
 {
@@ -92,20 +342,66 @@ page_get (const void *vaddr, bool stack)
     return NULL;
 
   struct thread *t = thread_current();
-  struct page_table_entry pte;
-  pte.upage = pg_round_down (vaddr);
-  struct hash_elem *elem = hash_find (&t->page_table, &pte.hash_elem);
-  if (elem)
-    return hash_entry (elem, struct page_table_entry, hash_elem);
+  void *upage = pg_round_down (vaddr);
+  struct page_table_entry *pte = page_find (upage);
+  if (pte)
+    return pte;
+
+  struct mapping *mapping = page_find_mapping (upage, PGSIZE);
+  if (mapping)
+    return page_alloc_mapped (mapping, upage);
   /* Checking that the page address is inside max stack size
    and at most 32 bytes away. */
-  else if (stack && PHYS_BASE - USER_STACK <= pte.upage
+  else if (stack && PHYS_BASE - USER_STACK <= upage
            && t->esp - 32 <= vaddr)
-    return page_alloc (pte.upage, true);
+    return page_alloc (upage, true);
   else
     return NULL;
 }
 
+/* Returns the current thread's page at UPAGE, or NULL if it has
+   none yet. */
+struct page_table_entry *
+page_find (const void *upage)
+{
+  struct page_table_entry pte;
+  pte.upage = (void *) upage;
+  struct hash_elem *elem = hash_find (&thread_current ()->page_table,
+                                      &pte.hash_elem);
+  return elem ? hash_entry (elem, struct page_table_entry, hash_elem) : NULL;
+}
+
+/* Returns the current thread's memory mapping that overlaps the
+   SIZE bytes at UPAGE, or NULL if there is none. */
+struct mapping *
+page_find_mapping (const void *upage, size_t size)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  const uint8_t *start = upage;
+  for (struct list_elem *e = list_begin (mappings); e != list_end (mappings);
+       e = list_next (e)) {
+    struct mapping *m = list_entry (e, struct mapping, elem);
+    if (start < m->base + m->page_cnt * PGSIZE && m->base < start + size)
+      return m;
+  }
+  return NULL;
+}
+
+/* Creates the page table entry for UPAGE within MAPPING. */
+static struct page_table_entry *
+page_alloc_mapped (struct mapping *mapping, void *upage)
+{
+  struct page_table_entry *pte = page_alloc (upage, mapping->writable);
+  if (!pte)
+    return NULL;
+  pte->file = mapping->file;
+  pte->file_ofs = (uint8_t *) upage - mapping->base;
+  pte->file_bytes = mapping->length - pte->file_ofs < PGSIZE
+                    ? mapping->length - pte->file_ofs : PGSIZE;
+  pte->mapped = true;
+  return pte;
+}
+
 /* Given an address, allocate an entry in the page table (without loading) */
 struct page_table_entry *
 page_alloc (const void *vaddr, bool writable)
@@ -123,6 +419,23 @@ page_alloc (const void *vaddr, bool writable)
   return pte;
 }
 
+/* Returns true if PTE is an anonymous page that has never been
+   written, so its contents are all zeros. */
+static bool
+page_is_fresh (const struct page_table_entry *pte)
+{
+  return !pte->file && !pte->swapped && pte->sector == -1
+         && pte->zslot == -1;
+}
+
+/* Returns true if PTE is a read-only file page, whose frame can
+   be shared with other processes mapping the same file page. */
+static bool
+page_is_shareable (const struct page_table_entry *pte)
+{
+  return pte->file && !pte->writable && !pte->mapped;
+}
+
 /* Page init. */
 static void
 page_init (struct page_table_entry *pte)
@@ -134,6 +447,7 @@ page_init (struct page_table_entry *pte)
 
   pte->swapped = false;
   pte->sector = -1;
+  pte->zslot = -1;
 
   pte->file = NULL;
   pte->file_ofs = 0;
@@ -142,6 +456,7 @@ page_init (struct page_table_entry *pte)
   pte->mapped = false;
 
   pte->fte = NULL;
+  pte->zero = false;
 }
 
 /* Read stored data into pages. */
@@ -152,6 +467,7 @@ page_read (struct page_table_entry *pte)
   ASSERT (pte->fte != NULL);
   ASSERT (lock_held_by_current_thread (&pte->fte->lock));
   struct frame_table_entry *fte = pte->fte;
+  pte->dirty = false;
   if (pte->swapped)
     swap_read (fte);
   else if (pte->file) {
@@ -166,42 +482,91 @@ page_read (struct page_table_entry *pte)
   return true;
 }
 
-/* Evict a page and save it to swap. */
+/* Evict a page and save it to swap.
+   If PTE is null, the victim is chosen by the frame table. */
 void
 page_evict (struct page_table_entry *pte)
 {
-  /* Locate the frame victim. */
+  struct frame_table_entry *fte;
+
+  /* Locate and lock the frame. */
   if (!pte) {
-    pte = frame_victim ();
-    frame_acquire (pte->fte);
-  } else if (pte->fte)
-    frame_acquire (pte->fte);
-
-  /* Write to swap if necessary. */
-  if (!pte->dirty)
-    pte->dirty = pagedir_is_dirty (pte->thread->pagedir, pte->upage);
-  if (pte->dirty && pte->fte)
-    page_write (pte);
+    fte = frame_victim ();
+    pte = fte->pte;
+  } else {
+    fte = pte->fte;
+    if (fte) {
+      frame_acquire (fte);
+      if (pte->fte != fte) {
+        /* Evicted by someone else while we waited. */
+        frame_release (fte);
+        fte = NULL;
+      }
+    }
+  }
 
-  /* Re-enable page faults for this address. */
-  pagedir_clear_page (pte->thread->pagedir, pte->upage);
+  if (!fte) {
+    /* Not resident, but perhaps mapped to the zero frame. */
+    pagedir_clear_page (pte->thread->pagedir, pte->upage);
+    pte->zero = false;
+    return;
+  }
+
+  /* Unmap the frame from every address space that maps it, which
+     re-enables page faults there, and note whether any of them
+     dirtied it. */
+  pte = fte->pte;
+  if (frame_unmap_all (fte))
+    pte->dirty = true;
+
+  /* Write out if necessary.  A clean page whose swap slot is still
+     valid goes back to that slot for free. */
+  if (pte->dirty)
+    page_write (pte);
+  else if (pte->sector != -1)
+    pte->swapped = true;
 
   /* Uninstall the frame. */
-  if (pte->fte)
-    frame_free (pte->fte);
   pte->fte = NULL;
+  frame_free (fte);
 }
 
-/* Write data to swap. */
+/* Releases PTE's frame and swap slot without saving its contents,
+   except that a dirty memory-mapped page is still written back to
+   its file.  For use when the page itself is going away. */
+void
+page_free (struct page_table_entry *pte)
+{
+  if (pte->mapped || pte->zero) {
+    page_evict (pte); // also unmaps the zero frame
+  } else {
+    struct frame_table_entry *fte = pte->fte;
+    if (fte) {
+      frame_acquire (fte);
+      if (pte->fte == fte) {
+        pte->fte = NULL;
+        if (frame_unmap (fte, pte))
+          frame_release (fte);
+        else
+          frame_free (fte);
+      } else
+        frame_release (fte);
+    }
+  }
+  swap_free (pte);
+}
+
+/* Write data to its backing store: the file for memory-mapped
+   pages, swap otherwise. */
 static void
 page_write (struct page_table_entry *pte)
 {
   ASSERT (pte != NULL);
   ASSERT (pte->fte != NULL);
   ASSERT (lock_held_by_current_thread (&pte->fte->lock));
-  if (pte->mapped && pte->file) {
+  if (pte->mapped && pte->file)
     file_write_at (pte->file, pte->fte->kpage, pte->file_bytes, pte->file_ofs);
-    pte->mapped = false;
-  } else
+  else
     swap_write (pte->fte);
+  pte->dirty = false;
 }
@@ -1,17 +1,46 @@
 #ifndef PAGE_H
 #define PAGE_H
 #include <hash.h>
+#include <list.h>
 #include "filesys/off_t.h"
 #include "vm/frame.h"
+#include "vm/mapid_t.h"
+
+/* A memory-mapped file.  Its pages' page table entries are only
+   created when first touched. */
+struct mapping
+{
+  mapid_t mapid;                  /* Map region identifier. */
+  struct file *file;              /* Mapped file. */
+  uint8_t *base;                  /* First page. */
+  size_t page_cnt;                /* Number of pages. */
+  off_t length;                   /* Number of bytes mapped from FILE. */
+  bool writable;                  /* True if the pages are writable. */
+  struct list_elem elem;          /* Element in thread's mappings. */
+};
 
 unsigned page_hash (const struct hash_elem *p_, void *aux);
 bool page_less (const struct hash_elem *a_, const struct hash_elem *b_,
                 void *aux);
 
-struct page_table_entry *page_load (const void *fault_addr);
+struct page_table_entry *page_load (const void *fault_addr, bool write);
+struct page_table_entry *page_pin (const void *vaddr, bool write);
+void page_unpin (struct page_table_entry *pte);
 struct page_table_entry *page_get (const void *vaddr, bool stack);
+struct page_table_entry *page_find (const void *upage);
+struct mapping *page_find_mapping (const void *upage, size_t size);
 struct page_table_entry *page_alloc (const void *vaddr, bool writable);
 void page_evict (struct page_table_entry *pte);
+void page_free (struct page_table_entry *pte);
+
+/* A mapping of a frame into an address space, for the frame's
+   reverse map. */
+struct rmap
+{
+  uint32_t *pagedir;              /* Page directory. */
+  void *upage;                    /* User virtual address. */
+  struct list_elem elem;          /* Element in frame's rmaps list. */
+};
 
 struct page_table_entry
 {
@@ -19,10 +48,13 @@ struct page_table_entry
   void *upage;                    /* Virtual address. */
   bool writable;                  /* Writable bit. Set at allocation. */
   bool accessed;                  /* Accessed bit. Set when read/write. */
-  bool dirty;                     /* Dirty bit. Set when write. */
+  bool dirty;                     /* True if newer than backing store. */
 
   bool swapped;                   /* True if page is swapped out. */
-  int sector;                     /* Swap sector page is located at. */
+  int sector;                     /* Swap sector of the page's slot, or -1.
+                                     Kept while resident, so a clean page
+                                     can be evicted without a write. */
+  int zslot;                      /* Compressed swap pool handle, or -1. */
 
   struct file *file;              /* File page pointer. */
   off_t file_ofs;                 /* File access offset. */
@@ -30,9 +62,10 @@ struct page_table_entry
   bool mapped;                    /* True if mapped. */
 
   struct frame_table_entry *fte;  /* Associated frame table entry. */
+  bool zero;                      /* True if mapped to the zero frame. */
 
   struct hash_elem hash_elem;     /* Hash element for page table. */
-  struct list_elem list_elem;     /* List element for memory mapping. */
+  struct rmap rmap;               /* Mapping of FTE, while it is set. */
 };
 
 #endif
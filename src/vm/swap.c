@@ -1,50 +1,191 @@
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 
 static struct block *swap_block;
 static struct bitmap *swap_map; // false is swap space available
+static struct lock swap_lock;    // protects swap_map and the cluster
 
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Slots are handed out from a cluster of SWAP_CLUSTER contiguous
+   slots reserved at once, so that pages evicted together, e.g. in
+   one batch of the page-out daemon, land next to each other in
+   swap and can be read back together. */
+#define SWAP_CLUSTER 16
+static size_t cluster_next;      // next unused slot in the cluster
+static size_t cluster_end;       // end of the cluster
+
+/* Page-ins, and how many of them the compressed pool served. */
+static unsigned long long read_cnt;
+static unsigned long long pool_hit_cnt;
+
+static size_t swap_alloc (void);
+static void swap_release_slot (struct page_table_entry *pte);
+
 void
 swap_init (void)
 {
   swap_block = block_get_role (BLOCK_SWAP);
   swap_map = bitmap_create (block_size (swap_block) / SECTORS_PER_PAGE);
+  lock_init (&swap_lock);
+  cluster_next = cluster_end = 0;
+  zswap_init ();
+
+  frame_pageout_start ();
 }
 
+/* Reads FTE's page back in, from the compressed pool if it is
+   there and from the swap device otherwise. */
 void
 swap_read (struct frame_table_entry *fte)
 {
   ASSERT (fte != NULL);
   ASSERT (lock_held_by_current_thread (&fte->lock));
-  ASSERT (fte->pte->sector != -1);
+  struct page_table_entry *pte = fte->pte;
+  ASSERT (pte->zslot != -1 || pte->sector != -1);
+
+  read_cnt++;
+  if (pte->zslot != -1) {
+    /* Drop the pool copy rather than keep it for a clean eviction:
+       pool space is memory, and the page is likely to be written
+       anyway.  The page then has no backing copy, so it is
+       dirty. */
+    zswap_load (pte->zslot, fte->kpage);
+    zswap_free (pte->zslot);
+    pte->zslot = -1;
+    pte->dirty = true;
+    pool_hit_cnt++;
+  } else {
+    block_read_multiple (swap_block, pte->sector, SECTORS_PER_PAGE,
+                         fte->kpage);
+    /* Keep the slot: until the page is dirtied, it is still a valid
+       copy, and evicting the page again needs no write. */
+  }
+  pte->swapped = false;
+}
 
-  for (int i = 0; i < SECTORS_PER_PAGE; i++)
-    block_read (swap_block, fte->pte->sector + i,
-                fte->kpage + (i * BLOCK_SECTOR_SIZE));
+/* Reads the pages of the CNT frames in FTES back in, as
+   swap_read () does one at a time, but with a single request to
+   the swap device.  The pages must be on the device, not in the
+   compressed pool, in consecutive slots in the order given. */
+void
+swap_read_multiple (struct frame_table_entry *ftes[], size_t cnt)
+{
+  ASSERT (cnt > 0);
+  void **buffers = malloc (cnt * SECTORS_PER_PAGE * sizeof *buffers);
+  if (!buffers) {
+    for (size_t i = 0; i < cnt; i++)
+      swap_read (ftes[i]);
+    return;
+  }
 
-  int page = fte->pte->sector / SECTORS_PER_PAGE;
-  bitmap_set (swap_map, page, false);
+  int sector = ftes[0]->pte->sector;
+  for (size_t i = 0; i < cnt; i++) {
+    struct page_table_entry *pte = ftes[i]->pte;
+    ASSERT (lock_held_by_current_thread (&ftes[i]->lock));
+    ASSERT (pte->zslot == -1);
+    ASSERT (pte->sector == sector + (int) (i * SECTORS_PER_PAGE));
+    for (size_t j = 0; j < SECTORS_PER_PAGE; j++)
+      buffers[i * SECTORS_PER_PAGE + j] = (uint8_t *) ftes[i]->kpage
+                                          + j * BLOCK_SECTOR_SIZE;
+  }
+  block_readv (swap_block, sector, cnt * SECTORS_PER_PAGE, buffers);
+  free (buffers);
 
-  fte->pte->swapped = false;
-  fte->pte->sector = -1;
+  /* As in swap_read (), the pages keep their slots. */
+  for (size_t i = 0; i < cnt; i++)
+    ftes[i]->pte->swapped = false;
+  read_cnt += cnt;
 }
 
+/* Writes FTE's page out, into the compressed pool if it fits and
+   to the swap device otherwise. */
 void
 swap_write (struct frame_table_entry *fte)
 {
   ASSERT (fte != NULL);
   ASSERT (lock_held_by_current_thread (&fte->lock));
+  struct page_table_entry *pte = fte->pte;
+  ASSERT (pte->zslot == -1);
+
+  pte->zslot = zswap_store (fte->kpage);
+  if (pte->zslot != -1) {
+    /* Any copy left in the page's swap slot is stale now. */
+    swap_release_slot (pte);
+  } else {
+    if (pte->sector == -1)
+      pte->sector = swap_alloc () * SECTORS_PER_PAGE;
+    block_write_multiple (swap_block, pte->sector, SECTORS_PER_PAGE,
+                          fte->kpage);
+  }
+  pte->swapped = true;
+}
 
-  size_t page = bitmap_scan_and_flip (swap_map, 0, 1, false);
-  if (page == BITMAP_ERROR)
-    PANIC ("NO SWAP SLOT AVAILABLE");
+/* Releases PTE's swap slot and compressed copy, if it has them. */
+void
+swap_free (struct page_table_entry *pte)
+{
+  if (pte->zslot != -1) {
+    zswap_free (pte->zslot);
+    pte->zslot = -1;
+  }
+  swap_release_slot (pte);
+  pte->swapped = false;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  unsigned long long pct = read_cnt ? pool_hit_cnt * 100 / read_cnt : 0;
+  printf ("swap: %llu page-ins, %llu from compressed pool "
+          "(%llu%% hit rate)\n", read_cnt, pool_hit_cnt, pct);
+  zswap_print_stats ();
+}
+
+/* Releases PTE's slot on the swap device, if it has one. */
+static void
+swap_release_slot (struct page_table_entry *pte)
+{
+  if (pte->sector == -1)
+    return;
+
+  lock_acquire (&swap_lock);
+  bitmap_set (swap_map, pte->sector / SECTORS_PER_PAGE, false);
+  lock_release (&swap_lock);
+  pte->sector = -1;
+}
+
+/* Allocates a swap slot and returns its index, taking it from the
+   current cluster if possible.  Panics if swap is full. */
+static size_t
+swap_alloc (void)
+{
+  size_t slot;
 
-  size_t sector = page * SECTORS_PER_PAGE;
-  for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
-    block_write (swap_block, sector + i, fte->kpage + (i * BLOCK_SECTOR_SIZE));
+  lock_acquire (&swap_lock);
+  if (cluster_next == cluster_end) {
+    /* Reserve a new cluster, or fall back to a single slot when
+       swap is too fragmented for one. */
+    size_t cnt = SWAP_CLUSTER;
+    size_t start = bitmap_scan_and_flip (swap_map, cluster_end, cnt, false);
+    if (start == BITMAP_ERROR)
+      start = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+    if (start == BITMAP_ERROR) {
+      cnt = 1;
+      start = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+    }
+    if (start == BITMAP_ERROR)
+      PANIC ("NO SWAP SLOT AVAILABLE");
+    cluster_next = start;
+    cluster_end = start + cnt;
+  }
+  slot = cluster_next++;
+  lock_release (&swap_lock);
 
-  fte->pte->swapped = true;
-  fte->pte->sector = sector;
+  return slot;
 }
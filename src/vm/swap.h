@@ -7,6 +7,9 @@
 
 void swap_init (void);
 void swap_read (struct frame_table_entry *fte);
+void swap_read_multiple (struct frame_table_entry *ftes[], size_t cnt);
 void swap_write (struct frame_table_entry *fte);
+void swap_free (struct page_table_entry *pte);
+void swap_print_stats (void);
 
 #endif
@@ -0,0 +1,331 @@
+#include <bitmap.h>
+#include <limits.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* The pool is carved out of the kernel pool at boot, sized as a
+   fraction of the user pool it backs, and handed out in chunks of
+   CHUNK_SIZE bytes.  A stored page takes a 2-byte length header
+   plus its compressed bytes, rounded up to whole chunks. */
+#define POOL_FRACTION 8
+#define CHUNK_SIZE 32
+
+/* Pages that do not compress below MAX_SIZE bytes go straight to
+   disk; they would cost nearly a page of pool for little gain. */
+#define MAX_SIZE (PGSIZE * 3 / 4)
+
+/* Handle of an all-zero page, which takes no pool space. */
+#define ZERO_HANDLE INT_MAX
+
+static uint8_t *pool;             /* Start of the pool. */
+static struct bitmap *pool_map;   /* One bit per chunk, true if used. */
+static struct lock zswap_lock;    /* Protects the pool and scratch space. */
+
+/* Statistics. */
+static unsigned long long store_cnt;    /* Pages stored, including zero. */
+static unsigned long long zero_cnt;     /* All-zero pages stored. */
+static unsigned long long reject_cnt;   /* Pages that did not compress. */
+static unsigned long long full_cnt;     /* Pages turned away, pool full. */
+static unsigned long long load_cnt;     /* Pages loaded back. */
+static unsigned long long pool_bytes;   /* Pool bytes used by stores. */
+
+static bool is_zero_page (const void *kpage);
+static size_t lz_compress (const uint8_t *src, size_t size,
+                           uint8_t *dst, size_t dst_size);
+static void lz_decompress (const uint8_t *src, size_t size,
+                           uint8_t *dst, size_t dst_size);
+
+/* Sets up the pool.  If the kernel pool cannot spare the memory,
+   the pool is left empty and every page falls through to disk. */
+void
+zswap_init (void)
+{
+  size_t user_pages;
+  palloc_user_pool (&user_pages);
+  size_t pages = user_pages / POOL_FRACTION;
+
+  lock_init (&zswap_lock);
+  if (pages == 0)
+    return;
+  pool = palloc_get_multiple (0, pages);
+  if (!pool)
+    return;
+  pool_map = bitmap_create (pages * PGSIZE / CHUNK_SIZE);
+  if (!pool_map) {
+    palloc_free_multiple (pool, pages);
+    pool = NULL;
+  }
+}
+
+/* Compresses KPAGE into the pool and returns a handle for it, or
+   -1 if the page does not compress well or the pool is full. */
+int
+zswap_store (const void *kpage)
+{
+  static uint8_t scratch[MAX_SIZE];
+  int handle = -1;
+
+  if (!pool)
+    return -1;
+
+  lock_acquire (&zswap_lock);
+  if (is_zero_page (kpage)) {
+    zero_cnt++;
+    store_cnt++;
+    handle = ZERO_HANDLE;
+  } else {
+    size_t size = lz_compress (kpage, PGSIZE, scratch, sizeof scratch);
+    if (size == 0)
+      reject_cnt++;
+    else {
+      size_t chunks = DIV_ROUND_UP (size + sizeof (uint16_t), CHUNK_SIZE);
+      size_t start = bitmap_scan_and_flip (pool_map, 0, chunks, false);
+      if (start == BITMAP_ERROR)
+        full_cnt++;
+      else {
+        uint8_t *p = pool + start * CHUNK_SIZE;
+        uint16_t len = size;
+        memcpy (p, &len, sizeof len);
+        memcpy (p + sizeof len, scratch, size);
+        store_cnt++;
+        pool_bytes += chunks * CHUNK_SIZE;
+        handle = start;
+      }
+    }
+  }
+  lock_release (&zswap_lock);
+
+  return handle;
+}
+
+/* Decompresses the page stored under HANDLE into KPAGE.  The
+   page stays in the pool until zswap_free (). */
+void
+zswap_load (int handle, void *kpage)
+{
+  ASSERT (handle >= 0);
+
+  if (handle == ZERO_HANDLE)
+    memset (kpage, 0, PGSIZE);
+  else {
+    uint8_t *p = pool + handle * CHUNK_SIZE;
+    uint16_t len;
+    memcpy (&len, p, sizeof len);
+    lz_decompress (p + sizeof len, len, kpage, PGSIZE);
+  }
+
+  lock_acquire (&zswap_lock);
+  load_cnt++;
+  lock_release (&zswap_lock);
+}
+
+/* Releases the pool space of the page stored under HANDLE. */
+void
+zswap_free (int handle)
+{
+  ASSERT (handle >= 0);
+
+  if (handle == ZERO_HANDLE)
+    return;
+
+  lock_acquire (&zswap_lock);
+  uint8_t *p = pool + handle * CHUNK_SIZE;
+  uint16_t len;
+  memcpy (&len, p, sizeof len);
+  size_t chunks = DIV_ROUND_UP (len + sizeof len, CHUNK_SIZE);
+  bitmap_set_multiple (pool_map, handle, chunks, false);
+  lock_release (&zswap_lock);
+}
+
+/* Prints compressed pool statistics. */
+void
+zswap_print_stats (void)
+{
+  if (!pool) {
+    printf ("zswap: disabled\n");
+    return;
+  }
+
+  /* Compression ratio of the compressed pages, in hundredths.
+     Zero pages take no pool space, so they are counted apart. */
+  unsigned long long compressed = store_cnt - zero_cnt;
+  unsigned long long raw = compressed * PGSIZE;
+  unsigned long long ratio = pool_bytes ? raw * 100 / pool_bytes : 0;
+  printf ("zswap: %llu stores, %llu loads, "
+          "%llu incompressible, %llu pool full\n",
+          store_cnt, load_cnt, reject_cnt, full_cnt);
+  printf ("zswap: %llu zero pages, stored without pool space\n", zero_cnt);
+  printf ("zswap: %llu compressed pages, %llu bytes in %llu bytes of pool, "
+          "ratio %llu.%02llu\n",
+          compressed, raw, pool_bytes, ratio / 100, ratio % 100);
+}
+
+/* Returns true if KPAGE is all zeros. */
+static bool
+is_zero_page (const void *kpage)
+{
+  const uint32_t *p = kpage;
+  for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+    if (p[i])
+      return false;
+  return true;
+}
+
+/* A small LZ77 codec in the style of LZ4.  The compressed stream
+   is a series of sequences, each a token byte whose high nibble is
+   a literal count and low nibble a match length minus LZ_MIN_MATCH,
+   then any extra literal count bytes, the literals, a 2-byte match
+   offset, and any extra match length bytes.  A nibble of 15 is
+   followed by extra bytes that add to it, each 255 meaning another
+   follows.  The last sequence has only literals. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+/* Positions of recently seen 4-byte strings, by hash. */
+static uint16_t lz_hash_table[1 << LZ_HASH_BITS];
+
+static uint32_t
+lz_read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+static unsigned
+lz_hash (uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extra bytes for a length nibble of 15. */
+static uint8_t *
+lz_put_length (uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/* Writes a sequence of LIT_CNT literals from LIT followed, unless
+   OFS is 0, by a match of MATCH_LEN bytes at distance OFS.
+   Returns the end of the output, or NULL if it would not fit
+   before OP_END. */
+static uint8_t *
+lz_put_sequence (uint8_t *op, uint8_t *op_end, const uint8_t *lit,
+                 size_t lit_cnt, size_t ofs, size_t match_len)
+{
+  size_t extra = match_len - (ofs ? LZ_MIN_MATCH : 0);
+  size_t need = 1 + lit_cnt / 255 + 1 + lit_cnt + 2 + extra / 255 + 1;
+  if (need > (size_t) (op_end - op))
+    return NULL;
+
+  uint8_t *token = op++;
+  *token = (lit_cnt < 15 ? lit_cnt : 15) << 4;
+  if (lit_cnt >= 15)
+    op = lz_put_length (op, lit_cnt - 15);
+  memcpy (op, lit, lit_cnt);
+  op += lit_cnt;
+
+  if (ofs) {
+    *token |= extra < 15 ? extra : 15;
+    *op++ = ofs & 0xff;
+    *op++ = ofs >> 8;
+    if (extra >= 15)
+      op = lz_put_length (op, extra - 15);
+  }
+  return op;
+}
+
+/* Compresses SIZE bytes from SRC into DST, which holds DST_SIZE
+   bytes.  Returns the compressed size, or 0 if it does not fit.
+   Must be called with zswap_lock held, for lz_hash_table. */
+static size_t
+lz_compress (const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size)
+{
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *end = src + size;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+
+  ASSERT (size <= UINT16_MAX);
+  memset (lz_hash_table, 0, sizeof lz_hash_table);
+
+  while (ip + LZ_MIN_MATCH <= end) {
+    uint32_t v = lz_read32 (ip);
+    unsigned h = lz_hash (v);
+    const uint8_t *ref = src + lz_hash_table[h];
+    lz_hash_table[h] = ip - src;
+    if (ref >= ip || lz_read32 (ref) != v) {
+      ip++;
+      continue;
+    }
+
+    const uint8_t *m = ip + LZ_MIN_MATCH;
+    while (m < end && *m == ref[m - ip])
+      m++;
+    op = lz_put_sequence (op, op_end, anchor, ip - anchor, ip - ref, m - ip);
+    if (!op)
+      return 0;
+    ip = anchor = m;
+  }
+
+  op = lz_put_sequence (op, op_end, anchor, end - anchor, 0, 0);
+  return op ? (size_t) (op - dst) : 0;
+}
+
+/* Reads the extra bytes of a length nibble of 15 at *IP. */
+static size_t
+lz_get_length (const uint8_t **ip)
+{
+  size_t len = 0;
+  uint8_t b;
+  do {
+    b = *(*ip)++;
+    len += b;
+  } while (b == 255);
+  return len;
+}
+
+/* Decompresses SIZE bytes from SRC, produced by lz_compress (),
+   into DST_SIZE bytes at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size)
+{
+  const uint8_t *ip = src;
+  const uint8_t *ip_end = src + size;
+  uint8_t *op = dst;
+
+  for (;;) {
+    unsigned token = *ip++;
+    size_t lit_cnt = token >> 4;
+    if (lit_cnt == 15)
+      lit_cnt += lz_get_length (&ip);
+    memcpy (op, ip, lit_cnt);
+    op += lit_cnt;
+    ip += lit_cnt;
+    if (ip >= ip_end)
+      break;
+
+    size_t ofs = ip[0] | ip[1] << 8;
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15)
+      match_len += lz_get_length (&ip);
+    match_len += LZ_MIN_MATCH;
+
+    /* Byte by byte, since the match may overlap its own output. */
+    const uint8_t *ref = op - ofs;
+    while (match_len-- > 0)
+      *op++ = *ref++;
+  }
+  ASSERT (op == dst + dst_size);
+}
@@ -0,0 +1,16 @@
+#ifndef ZSWAP_H
+#define ZSWAP_H
+
+#include <stdbool.h>
+
+/* Compressed swap pool.  Sits in front of the swap device: pages
+   are compressed into a pool of kernel memory and only go to disk
+   when they do not fit. */
+
+void zswap_init (void);
+int zswap_store (const void *kpage);
+void zswap_load (int handle, void *kpage);
+void zswap_free (int handle);
+void zswap_print_stats (void);
+
+#endif